@@ -0,0 +1,71 @@
+/*
+* intercept.h What the files of the intercept module share with each other.
+*/
+
+#ifndef INTERCEPT_H
+#define INTERCEPT_H
+
+#include <linux/jump_label.h>
+#include <linux/proc_fs.h>
+
+#include "intercept_uapi.h"
+
+/* /proc/intercept, every part of the module puts its report files in here */
+extern struct proc_dir_entry *intercept_proc_dir;
+
+/* intercept_events.c: the per-CPU event rings behind /dev/intercept */
+int intercept_events_init(void);
+void intercept_events_exit(void);
+void intercept_event_record(const struct intercept_event *ev);
+
+/* intercept_netlink.c: batched multicast of the events over generic netlink,
+ * used instead of the event rings while the key is on.
+ */
+DECLARE_STATIC_KEY_FALSE(intercept_netlink);
+int intercept_netlink_init(void);
+void intercept_netlink_exit(void);
+void intercept_netlink_record(const struct intercept_event *ev);
+
+/* intercept_intern.c: the path dictionary, known paths go into the events
+ * as their id while the key is on.
+ */
+DECLARE_STATIC_KEY_FALSE(intercept_intern);
+int intercept_intern_init(void);
+void intercept_intern_exit(void);
+u32 intercept_intern_path(const char *path, u16 len);
+size_t intercept_intern_drain(void *buf, size_t size);
+
+/* intercept_filter.c: the rules of /proc/intercept/filter. While the key is
+ * off there is no filter and the hook reports the uid module parameter.
+ */
+DECLARE_STATIC_KEY_FALSE(intercept_filter_on);
+int intercept_filter_init(void);
+void intercept_filter_exit(void);
+bool intercept_filter_task(u32 uid, u32 pid);
+bool intercept_filter_path(const char *path);
+
+/* intercept_sample.c: 1 in N sampling and a per-CPU rate limit of the calls
+ * that passed the uid or task filter, while the key is on.
+ */
+DECLARE_STATIC_KEY_FALSE(intercept_sampling);
+int intercept_sample_init(void);
+void intercept_sample_exit(void);
+bool intercept_sample(void);
+
+/* intercept_aggr.c: per path counters behind /proc/intercept/top, used
+ * instead of the event rings while the key is on.
+ */
+DECLARE_STATIC_KEY_FALSE(intercept_aggregate);
+int intercept_aggr_init(void);
+void intercept_aggr_exit(void);
+void intercept_aggr_count(const char *path, u16 len, u32 uid);
+
+/* intercept_hist.c: latency histograms behind /proc/intercept/latency, the
+ * hook times the original call while the key is on.
+ */
+DECLARE_STATIC_KEY_FALSE(intercept_latency);
+int intercept_hist_init(void);
+void intercept_hist_exit(void);
+void intercept_hist_record(u64 ns, u32 uid, int flags);
+
+#endif /* INTERCEPT_H */
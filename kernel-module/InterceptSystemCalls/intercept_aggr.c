@@ -0,0 +1,387 @@
+/*
+* intercept_aggr.c Aggregation mode: count the opens per path instead of
+* recording every one of them.
+*
+* Often the question is only which files are opened most, and by whom. With
+* aggregate=1 the hook no longer puts events into the rings, it bumps the
+* counter of the path (and with aggregate_uid=1 of the path and the uid) in a
+* table of at most aggr_entries entries, and /proc/intercept/top reports the
+* top_n busiest ones. What userspace reads is then bounded by the number of
+* distinct paths, not by the open rate.
+*
+* The table is a hash of RCU lists. The hook looks the path up under
+* rcu_read_lock and, on a hit, only increments its own CPU's counter of the
+* entry, so busy paths opened on many CPUs do not bounce a cache line. Only a
+* path that is not in the table yet takes aggr_lock to be added. When the
+* table is full, the coldest of a few randomly picked entries (the lowest
+* count) is evicted to make room, what it counted goes to the evicted totals.
+*
+* Every entry owns a slot, the index of its counter in the per-CPU counter
+* arrays. The slot of an evicted entry only becomes free again after an RCU
+* grace period, once no hook can still be counting into it, so there are
+* twice as many slots as entries. The counter arrays are the rows of a single
+* kvcalloc'd array, one cache line aligned row per possible CPU, as the
+* default table alone is too big for a per-CPU allocation (at most 32 KiB).
+*/
+
+#include <linux/cache.h>
+#include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/jump_label.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/proc_fs.h>
+#include <linux/random.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+
+#include "intercept.h"
+
+#define AGGR_EVICT_SAMPLES 5
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define get_random_u32_below prandom_u32_max
+#endif
+
+/* aggregate=1 counts opens per path instead of recording events. The check
+ * in the hook is a static key, so it costs nothing while off.
+ */
+DEFINE_STATIC_KEY_FALSE(intercept_aggregate);
+
+static int aggregate_param_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(val, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        static_branch_enable(&intercept_aggregate);
+    else
+        static_branch_disable(&intercept_aggregate);
+    return 0;
+}
+
+static int aggregate_param_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&intercept_aggregate) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops aggregate_param_ops = {
+    .set = aggregate_param_set,
+    .get = aggregate_param_get,
+};
+module_param_cb(aggregate, &aggregate_param_ops, NULL, 0644);
+MODULE_PARM_DESC(aggregate, "Count opens per path in /proc/intercept/top instead of recording events (default N)");
+
+static bool aggregate_uid;
+module_param(aggregate_uid, bool, 0444);
+MODULE_PARM_DESC(aggregate_uid, "Count per path and uid rather than per path (default N)");
+
+static unsigned int aggr_entries = 4096;
+module_param(aggr_entries, uint, 0444);
+MODULE_PARM_DESC(aggr_entries, "Most distinct paths counted at a time (default 4096, at most 1M and what fits in 2 GiB of counters)");
+
+static unsigned int top_n = 50;
+module_param(top_n, uint, 0644);
+MODULE_PARM_DESC(top_n, "Number of paths /proc/intercept/top reports (default 50)");
+
+struct aggr_entry {
+    struct hlist_node node;
+    struct rcu_head rcu;
+    u32 hash;
+    u32 uid;   // 0 unless aggregate_uid
+    u32 slot;
+    u16 len;
+    char path[]; // NUL terminated
+};
+
+/* Everything below aggr_lock is only changed with it held. It is taken with
+ * interrupts off: the RCU callback of an evicted entry takes it from softirq
+ * context, and the kprobe hook can run with interrupts already disabled.
+ */
+static DEFINE_SPINLOCK(aggr_lock);
+static struct hlist_head *aggr_buckets;
+static unsigned int aggr_bits;
+static struct aggr_entry **aggr_slots;     // owner of every slot, NULL if free or waiting for a grace period
+static u32 *aggr_free;                     // stack of free slots
+static u32 aggr_nr_free;
+static u32 aggr_nr_slots;
+static u32 aggr_live;
+static u64 aggr_evicted;                   // entries evicted so far
+static u64 aggr_evicted_opens;             // what they had counted
+static u64 aggr_dropped;                   // opens not counted, no memory or no free slot
+
+static u64 *aggr_counts;                   // [nr_cpu_ids][aggr_row] counters
+static u32 aggr_row;                       // aggr_nr_slots rounded up to a cache line
+
+static struct proc_dir_entry *top_proc_file;
+
+static u64 *aggr_count(int cpu, u32 slot)
+{
+    return &aggr_counts[(size_t)cpu * aggr_row + slot];
+}
+
+/* The hook counts into the row of the CPU it runs on */
+static void aggr_inc(u32 slot)
+{
+    (*aggr_count(get_cpu(), slot))++;
+    put_cpu();
+}
+
+static u64 aggr_sum(u32 slot)
+{
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        sum += *aggr_count(cpu, slot);
+    return sum;
+}
+
+static struct aggr_entry *aggr_lookup(u32 hash, u32 uid, const char *path, u16 len)
+{
+    struct aggr_entry *e;
+
+    hlist_for_each_entry_rcu(e, &aggr_buckets[hash_32(hash, aggr_bits)], node)
+        if (e->hash == hash && e->uid == uid && e->len == len && !memcmp(e->path, path, len))
+            return e;
+    return NULL;
+}
+
+/* After the grace period nobody counts into the slot any more: clear its
+ * counters and hand it out again.
+ */
+static void aggr_entry_free_rcu(struct rcu_head *rcu)
+{
+    struct aggr_entry *e = container_of(rcu, struct aggr_entry, rcu);
+    unsigned long flags;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        *aggr_count(cpu, e->slot) = 0;
+
+    spin_lock_irqsave(&aggr_lock, flags);
+    aggr_free[aggr_nr_free++] = e->slot;
+    spin_unlock_irqrestore(&aggr_lock, flags);
+
+    kfree(e);
+}
+
+/* Evicts the coldest of a few random entries. Caller holds aggr_lock. */
+static void aggr_evict(void)
+{
+    struct aggr_entry *e, *victim = NULL;
+    u64 count, victim_count = U64_MAX;
+    int i;
+
+    for (i = 0; i < AGGR_EVICT_SAMPLES * 4 && i < AGGR_EVICT_SAMPLES + aggr_live; i++) {
+        e = aggr_slots[get_random_u32_below(aggr_nr_slots)];
+        if (!e)
+            continue;
+        count = aggr_sum(e->slot);
+        if (count < victim_count) {
+            victim = e;
+            victim_count = count;
+        }
+    }
+    if (!victim)
+        return;
+
+    hlist_del_rcu(&victim->node);
+    aggr_slots[victim->slot] = NULL;
+    aggr_live--;
+    aggr_evicted++;
+    aggr_evicted_opens += victim_count;
+    call_rcu(&victim->rcu, aggr_entry_free_rcu);
+}
+
+/* The path is not in the table yet: add it with a count of one. Called
+ * under rcu_read_lock.
+ */
+static void aggr_insert(u32 hash, u32 uid, const char *path, u16 len)
+{
+    struct aggr_entry *e, *n;
+    unsigned long flags;
+
+    /* The hook may run with preemption disabled, so no sleeping allocation */
+    n = kmalloc(sizeof(*n) + len + 1, GFP_ATOMIC | __GFP_NOWARN);
+
+    spin_lock_irqsave(&aggr_lock, flags);
+    /* Somebody else may have added it meanwhile */
+    e = aggr_lookup(hash, uid, path, len);
+    if (e) {
+        aggr_inc(e->slot);
+        goto unlock;
+    }
+
+    if (aggr_live >= aggr_entries)
+        aggr_evict();
+
+    if (!n || !aggr_nr_free) {
+        aggr_dropped++;
+        goto unlock;
+    }
+
+    n->hash = hash;
+    n->uid = uid;
+    n->len = len;
+    memcpy(n->path, path, len);
+    n->path[len] = '\0';
+    n->slot = aggr_free[--aggr_nr_free];
+    aggr_slots[n->slot] = n;
+    aggr_live++;
+    aggr_inc(n->slot);
+    hlist_add_head_rcu(&n->node, &aggr_buckets[hash_32(hash, aggr_bits)]);
+    n = NULL;
+unlock:
+    spin_unlock_irqrestore(&aggr_lock, flags);
+    kfree(n);
+}
+
+/* Called by the hook instead of intercept_event_record while aggregate is on */
+void intercept_aggr_count(const char *path, u16 len, u32 uid)
+{
+    struct aggr_entry *e;
+    u32 hash;
+
+    if (!aggregate_uid)
+        uid = 0;
+    hash = jhash(path, len, uid);
+
+    rcu_read_lock();
+    e = aggr_lookup(hash, uid, path, len);
+    if (e)
+        aggr_inc(e->slot);
+    else
+        aggr_insert(hash, uid, path, len);
+    rcu_read_unlock();
+}
+
+struct aggr_top {
+    u64 count;
+    struct aggr_entry *e;
+};
+
+static int aggr_top_cmp(const void *a, const void *b)
+{
+    const struct aggr_top *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return 0;
+}
+
+/* /proc/intercept/top: the totals, then the top_n paths by count. The
+ * entries are collected and sorted under rcu_read_lock, so none of them can
+ * be freed while they are printed.
+ */
+static int top_show(struct seq_file *m, void *v)
+{
+    struct aggr_top *top;
+    struct aggr_entry *e;
+    u32 nr = 0, i, n = READ_ONCE(top_n);
+    u64 total = 0;
+
+    top = kvmalloc_array(aggr_nr_slots, sizeof(*top), GFP_KERNEL);
+    if (!top)
+        return -ENOMEM;
+
+    rcu_read_lock();
+    for (i = 0; i < (1U << aggr_bits); i++) {
+        hlist_for_each_entry_rcu(e, &aggr_buckets[i], node) {
+            if (nr == aggr_nr_slots)
+                break;
+            top[nr].e = e;
+            top[nr].count = aggr_sum(e->slot);
+            total += top[nr].count;
+            nr++;
+        }
+    }
+
+    sort(top, nr, sizeof(*top), aggr_top_cmp, NULL);
+
+    seq_printf(m, "paths %u opens %llu evicted %llu evicted_opens %llu dropped %llu\n",
+               nr, total, READ_ONCE(aggr_evicted), READ_ONCE(aggr_evicted_opens),
+               READ_ONCE(aggr_dropped));
+    seq_puts(m, aggregate_uid ? "count\tuid\tpath\n" : "count\tpath\n");
+    for (i = 0; i < nr && i < n; i++) {
+        if (aggregate_uid)
+            seq_printf(m, "%llu\t%u\t%s\n", top[i].count, top[i].e->uid, top[i].e->path);
+        else
+            seq_printf(m, "%llu\t%s\n", top[i].count, top[i].e->path);
+    }
+    rcu_read_unlock();
+
+    kvfree(top);
+    return 0;
+}
+
+static void aggr_free_table(void)
+{
+    u32 i;
+
+    if (aggr_slots)
+        for (i = 0; i < aggr_nr_slots; i++)
+            kfree(aggr_slots[i]);
+    kvfree(aggr_slots);
+    kvfree(aggr_free);
+    kvfree(aggr_buckets);
+    kvfree(aggr_counts);
+}
+
+int intercept_aggr_init(void)
+{
+    unsigned int max_entries;
+    u32 i;
+
+    /* kvmalloc hands out at most INT_MAX bytes, and there are two counters
+     * per entry per CPU (less a cache line of padding per row)
+     */
+    max_entries = min_t(size_t, 1U << 20, INT_MAX / (2 * sizeof(u64) * nr_cpu_ids) - SMP_CACHE_BYTES);
+    aggr_entries = clamp_t(unsigned int, aggr_entries, 16U, max_entries);
+    aggr_nr_slots = aggr_entries * 2;
+    aggr_row = ALIGN(aggr_nr_slots, SMP_CACHE_BYTES / sizeof(u64));
+    aggr_bits = ilog2(roundup_pow_of_two(aggr_entries));
+
+    aggr_buckets = kvcalloc(1U << aggr_bits, sizeof(*aggr_buckets), GFP_KERNEL);
+    aggr_slots = kvcalloc(aggr_nr_slots, sizeof(*aggr_slots), GFP_KERNEL);
+    aggr_free = kvmalloc_array(aggr_nr_slots, sizeof(*aggr_free), GFP_KERNEL);
+    aggr_counts = kvcalloc((size_t)nr_cpu_ids * aggr_row, sizeof(*aggr_counts), GFP_KERNEL);
+    if (!aggr_buckets || !aggr_slots || !aggr_free || !aggr_counts)
+        goto nomem;
+
+    for (i = 0; i < aggr_nr_slots; i++)
+        aggr_free[i] = aggr_nr_slots - 1 - i;
+    aggr_nr_free = aggr_nr_slots;
+
+    top_proc_file = proc_create_single("top", 0400, intercept_proc_dir, top_show);
+    if (!top_proc_file) {
+        pr_alert("Error: Could not initialize /proc/intercept/top\n");
+        goto nomem;
+    }
+    return 0;
+
+nomem:
+    aggr_free_table();
+    return -ENOMEM;
+}
+
+/* Called once the hook is gone */
+void intercept_aggr_exit(void)
+{
+    proc_remove(top_proc_file);
+    /* Let the RCU callbacks of evicted entries finish with the table */
+    rcu_barrier();
+    aggr_free_table();
+}
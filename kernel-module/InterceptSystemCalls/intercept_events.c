@@ -0,0 +1,388 @@
+/*
+* intercept_events.c Per-CPU event rings for the intercepted calls.
+*
+* The hook used to pr_info every open, which takes the console lock and stalls
+* the opener, and at a few thousand opens per second the log drops lines
+* anyway. Instead the hook fills a fixed size binary event (struct
+* intercept_event, see intercept_uapi.h) and intercept_event_record copies it
+* into a ring that belongs to the CPU it runs on. Only that CPU ever writes to
+* the ring, with preemption disabled, so recording takes no lock and no atomic
+* instruction; the consumer only moves the tail. When a ring is full the event
+* is dropped and counted, the opener never waits for the consumer.
+*
+* The rings are read through /dev/intercept, either with read() (whole events,
+* any number of them per call) or by mmap'ing the rings and following the
+* protocol in intercept_uapi.h. /proc/intercept/events reports per CPU how many
+* events were recorded and dropped.
+*/
+
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "intercept.h"
+
+#define DEVICE_NAME "intercept"
+
+/* Events per CPU ring, rounded up to a power of two, e.g.
+ * insmod intercept.ko ring_events=65536
+ */
+static unsigned int ring_events = 1024;
+module_param(ring_events, uint, 0444);
+MODULE_PARM_DESC(ring_events, "Events per CPU ring (default 1024)");
+
+struct intercept_ring {
+    /* vmalloc_user area: the control page followed by the slots, mapped as a
+     * whole by mmap.
+     */
+    void *mem;
+    struct intercept_ring_ctrl *ctrl;
+    struct intercept_event *slots;
+
+    /* The producer's own copies of head and of the drop count. ctrl is
+     * writable from userspace, so the module never reads its own counters
+     * back from there.
+     */
+    u64 head;
+    u64 drops;
+};
+
+static DEFINE_PER_CPU(struct intercept_ring, intercept_rings);
+static u32 nr_slots;
+static size_t ring_size;
+
+/* The consumer sleeping in read() or poll() until some ring has events */
+static DECLARE_WAIT_QUEUE_HEAD(intercept_wait);
+
+/* /dev/intercept has a single consumer, so only one open at a time */
+static unsigned long intercept_busy;
+
+/* Where read() starts looking, so a busy CPU can not starve the others */
+static unsigned int read_cpu;
+
+static struct proc_dir_entry *events_proc_file;
+
+/* Called from the hook with the caller's event. The path is copied up to its
+ * NUL and the rest of the slot is cleared, so nothing of an older event (or
+ * of the caller's stack) leaks into the ring.
+ */
+void intercept_event_record(const struct intercept_event *ev)
+{
+    size_t len = offsetof(struct intercept_event, path) + ev->path_len + 1;
+    struct intercept_ring *r;
+    struct intercept_event *slot;
+    u64 head;
+
+    preempt_disable();
+    r = this_cpu_ptr(&intercept_rings);
+    head = r->head;
+
+    /* Pairs with the smp_store_release of tail by the consumer: the slot is
+     * only reused once the consumer is done reading it.
+     */
+    if (head - smp_load_acquire(&r->ctrl->tail) >= nr_slots) {
+        r->drops++;
+        WRITE_ONCE(r->ctrl->drops, r->drops);
+        goto out;
+    }
+
+    slot = &r->slots[head & (nr_slots - 1)];
+    memcpy(slot, ev, len);
+    memset((char *)slot + len, 0, INTERCEPT_EVENT_SIZE - len);
+
+    /* Publish the event; the consumer load_acquires head before reading it */
+    r->head = head + 1;
+    smp_store_release(&r->ctrl->head, r->head);
+
+    /* Wake the consumer, but only if it told us it ran out of events. A
+     * consumer that keeps up never sets need_wakeup, so the hook does not pay
+     * for a wakeup (or the wait queue lock) on its behalf. The barrier pairs
+     * with the one the consumer issues between setting need_wakeup and
+     * re-reading head.
+     */
+    smp_mb();
+    if (READ_ONCE(r->ctrl->need_wakeup) && xchg(&r->ctrl->need_wakeup, 0))
+        wake_up_interruptible(&intercept_wait);
+out:
+    preempt_enable();
+}
+
+static bool ring_pending(int cpu)
+{
+    struct intercept_ring_ctrl *ctrl = per_cpu(intercept_rings, cpu).ctrl;
+
+    return READ_ONCE(ctrl->head) != READ_ONCE(ctrl->tail);
+}
+
+static bool events_pending(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        if (ring_pending(cpu))
+            return true;
+    return false;
+}
+
+/* Wait condition for the consumer: true when some ring has events. Otherwise
+ * arm need_wakeup on all of them first, so that the next event wakes us, and
+ * check again in case an event raced with arming.
+ */
+static bool events_readable_or_arm(void)
+{
+    int cpu;
+
+    if (events_pending())
+        return true;
+
+    for_each_possible_cpu(cpu)
+        WRITE_ONCE(per_cpu(intercept_rings, cpu).ctrl->need_wakeup, 1);
+    /* Pairs with the barrier in intercept_event_record */
+    smp_mb();
+    return events_pending();
+}
+
+/* Copy up to max whole events of one CPU's ring to buf, returns the number of
+ * events copied or -EFAULT.
+ */
+static long ring_drain(int cpu, char __user *buf, size_t max)
+{
+    struct intercept_ring *r = per_cpu_ptr(&intercept_rings, cpu);
+    u64 tail = READ_ONCE(r->ctrl->tail);
+    /* Pairs with the smp_store_release of head in intercept_event_record */
+    u64 head = smp_load_acquire(&r->ctrl->head);
+    size_t n, first;
+
+    /* A tail a mapping left behind can not make us read past the head */
+    if (head - tail > nr_slots)
+        tail = head - nr_slots;
+
+    n = min_t(u64, head - tail, max);
+    if (!n)
+        return 0;
+
+    first = min_t(size_t, n, nr_slots - (tail & (nr_slots - 1)));
+    if (copy_to_user(buf, &r->slots[tail & (nr_slots - 1)], first * INTERCEPT_EVENT_SIZE))
+        return -EFAULT;
+    if (copy_to_user(buf + first * INTERCEPT_EVENT_SIZE, r->slots,
+                     (n - first) * INTERCEPT_EVENT_SIZE))
+        return -EFAULT;
+
+    /* Hand the slots back to the producer */
+    smp_store_release(&r->ctrl->tail, tail + n);
+    return n;
+}
+
+/* Returns as many whole events as fit into the buffer, from all CPUs. Blocks
+ * until there is at least one, unless the file was opened O_NONBLOCK.
+ */
+static ssize_t intercept_read(struct file *filp, char __user *buf, size_t count, loff_t *offset)
+{
+    size_t max = count / INTERCEPT_EVENT_SIZE;
+    size_t done;
+    unsigned int i, cpu = read_cpu;
+    long n;
+    int ret;
+
+    if (!max)
+        return -EINVAL;
+
+    for (;;) {
+        done = 0;
+        for (i = 0; i < nr_cpu_ids && done < max; i++) {
+            cpu = (read_cpu + i) % nr_cpu_ids;
+            if (!cpu_possible(cpu))
+                continue;
+
+            n = ring_drain(cpu, buf + done * INTERCEPT_EVENT_SIZE, max - done);
+            if (n < 0)
+                return done ? done * INTERCEPT_EVENT_SIZE : n;
+            done += n;
+        }
+        /* The buffer filled up at cpu, carry on after it next time */
+        if (done == max)
+            read_cpu = (cpu + 1) % nr_cpu_ids;
+
+        if (done)
+            return done * INTERCEPT_EVENT_SIZE;
+
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        ret = wait_event_interruptible(intercept_wait, events_readable_or_arm());
+        if (ret)
+            return ret;
+    }
+}
+
+static __poll_t intercept_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    poll_wait(filp, &intercept_wait, wait);
+    return events_readable_or_arm() ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/* Maps the ring of one CPU: the file offset selects the CPU (cpu * ring_size),
+ * the mapping can not be larger than one ring.
+ */
+static int intercept_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    unsigned long cpu;
+
+    if ((vma->vm_pgoff << PAGE_SHIFT) % ring_size)
+        return -EINVAL;
+
+    cpu = (vma->vm_pgoff << PAGE_SHIFT) / ring_size;
+    if (cpu >= nr_cpu_ids || !cpu_possible(cpu))
+        return -EINVAL;
+
+    /* remap_vmalloc_range checks that the vma fits into the ring */
+    return remap_vmalloc_range(vma, per_cpu(intercept_rings, cpu).mem, 0);
+}
+
+static int intercept_open(struct inode *inode, struct file *filp)
+{
+    if (test_and_set_bit_lock(0, &intercept_busy))
+        return -EBUSY;
+
+    return stream_open(inode, filp);
+}
+
+static int intercept_release(struct inode *inode, struct file *filp)
+{
+    clear_bit_unlock(0, &intercept_busy);
+    return 0;
+}
+
+static const struct file_operations intercept_fops = {
+    .owner = THIS_MODULE,
+    .open = intercept_open,
+    .release = intercept_release,
+    .read = intercept_read,
+    .poll = intercept_poll,
+    .mmap = intercept_mmap,
+};
+
+/* The events carry the paths other users open, so root only */
+static struct miscdevice intercept_miscdev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = DEVICE_NAME,
+    .fops = &intercept_fops,
+    .mode = 0400,
+};
+
+/* /proc/intercept/events, one line per possible CPU */
+static int events_show(struct seq_file *m, void *v)
+{
+    struct intercept_ring *r;
+    u64 head, tail;
+    int cpu;
+
+    seq_puts(m, "cpu\tevents\tdrops\tqueued\n");
+    for_each_possible_cpu(cpu) {
+        r = per_cpu_ptr(&intercept_rings, cpu);
+        head = READ_ONCE(r->head);
+        tail = READ_ONCE(r->ctrl->tail);
+        seq_printf(m, "%d\t%llu\t%llu\t%llu\n", cpu, head, READ_ONCE(r->drops),
+                   head - tail > nr_slots ? (u64)nr_slots : head - tail);
+    }
+    return 0;
+}
+
+static void rings_free(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu(intercept_rings, cpu).mem);
+        per_cpu(intercept_rings, cpu).mem = NULL;
+    }
+}
+
+static int rings_alloc(void)
+{
+    struct intercept_ring *r;
+    int cpu;
+
+    BUILD_BUG_ON(sizeof(struct intercept_event) != INTERCEPT_EVENT_SIZE);
+    BUILD_BUG_ON(sizeof(struct intercept_ring_ctrl) > PAGE_SIZE);
+
+    nr_slots = roundup_pow_of_two(clamp(ring_events, (unsigned int)(PAGE_SIZE / INTERCEPT_EVENT_SIZE),
+                                        1U << 20));
+    ring_size = PAGE_SIZE + (size_t)nr_slots * INTERCEPT_EVENT_SIZE;
+
+    for_each_possible_cpu(cpu) {
+        r = per_cpu_ptr(&intercept_rings, cpu);
+        /* vmalloc_user zeroes the ring and lets remap_vmalloc_range map it */
+        r->mem = vmalloc_user(ring_size);
+        if (!r->mem) {
+            rings_free();
+            return -ENOMEM;
+        }
+        r->ctrl = r->mem;
+        r->slots = r->mem + PAGE_SIZE;
+        r->head = 0;
+        r->drops = 0;
+
+        r->ctrl->version = INTERCEPT_RING_VERSION;
+        r->ctrl->data_offset = PAGE_SIZE;
+        r->ctrl->nr_slots = nr_slots;
+        r->ctrl->ring_size = ring_size;
+    }
+
+    return 0;
+}
+
+int intercept_events_init(void)
+{
+    int ret;
+
+    ret = rings_alloc();
+    if (ret) {
+        pr_alert("Error: Could not allocate the event rings\n");
+        return ret;
+    }
+
+    events_proc_file = proc_create_single("events", 0444, intercept_proc_dir, events_show);
+    if (!events_proc_file) {
+        pr_alert("Error: Could not initialize /proc/intercept/events\n");
+        ret = -ENOMEM;
+        goto free_rings;
+    }
+
+    ret = misc_register(&intercept_miscdev);
+    if (ret) {
+        pr_alert("Error: Could not register /dev/%s\n", DEVICE_NAME);
+        goto remove_proc;
+    }
+
+    pr_info("/dev/%s: %u events per CPU ring\n", DEVICE_NAME, nr_slots);
+    return 0;
+
+remove_proc:
+    proc_remove(events_proc_file);
+free_rings:
+    rings_free();
+    return ret;
+}
+
+/* Called once the hook is gone and nobody records events any more. An open
+ * file or mapping holds a reference on the module, so nobody reads them either.
+ */
+void intercept_events_exit(void)
+{
+    misc_deregister(&intercept_miscdev);
+    proc_remove(events_proc_file);
+    rings_free();
+}
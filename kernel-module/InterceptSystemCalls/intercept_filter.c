@@ -0,0 +1,952 @@
+/*
+* intercept_filter.c Which calls the hook reports, decided in the kernel.
+*
+* Without a filter the hook reports the calls of the uid module parameter, as
+* it always did. Writing rules to /proc/intercept/filter installs a filter
+* instead, with three kinds of rules:
+*     add uid 1000        the caller's real uid is one of the uid rules
+*     add pid 4242        the caller's thread group id is one of the pid rules
+*     add path /etc/      the path starts with one of the path rules
+* A call is reported when it matches every kind that has rules (a kind
+* without rules does not restrict anything), so "add uid 1000" plus
+* "add path /etc/" reports the opens below /etc of uid 1000. Path rules compare
+* the path as the caller passed it, relative paths are not resolved, and only
+* apply to the syscalls that take one (open, openat, execve): a read is never
+* filtered by its path.
+* "del <kind> <value>" removes a rule and "clear" removes all of them, which
+* brings back the uid parameter.
+*
+* The rules written through one open file are applied together when it is
+* closed, so a whole rule set can be loaded with a single
+*     cat rules > /proc/intercept/filter
+* Every write parses its lines into the rules, so a bad line, too many rules
+* or no memory for them fail that write, and then nothing of that open file
+* is applied. The filter itself is built once, at close, together with a last
+* line without a newline; an error there (no memory for the filter) can just
+* be logged.
+*
+* Every change builds a new, read-only filter: open addressing hash tables for
+* the uid and pid rules and a prefix trie for the path rules, whose children
+* are kept sorted in one array so a lookup is a binary search per byte. The
+* hook looks it up under rcu_read_lock without taking any lock or writing any
+* shared cache line; the writer publishes the new filter with
+* rcu_assign_pointer and frees the old one after a grace period. While no
+* filter is installed the intercept_filter_on static key is off and the hook
+* does not even look.
+*
+* Reading /proc/intercept/filter shows per kind how many calls matched and
+* missed, and the hits of every rule (longest prefix wins for paths). The
+* counters are per CPU, one cache line aligned row per CPU in a single
+* kvcalloc'd array (a per-CPU allocation can not hold the hits of more than a
+* few thousand rules), and belong to the installed filter, so they start over
+* whenever the rules change. FILTER_RULES_MAX counts the rules of all kinds,
+* which keeps a row at 512 KiB at most.
+*/
+
+#include <linux/cache.h>
+#include <linux/cpumask.h>
+#include <linux/hash.h>
+#include <linux/jump_label.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+
+#include "intercept.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#define HAVE_PROC_OPS
+#endif
+
+#define FILTER_RULES_MAX 65536    // uid, pid and path rules together
+#define FILTER_LINE_MAX (INTERCEPT_PATH_MAX + 16)
+#define FILTER_WRITE_MAX (1 << 20) // bytes taken per write call
+
+#define FILTER_EMPTY ((u32)-1) // free hash slot, -1 is neither a valid uid nor a pid
+
+enum filter_kind {
+    FILTER_UID,
+    FILTER_PID,
+    FILTER_PATH,
+    FILTER_KINDS,
+};
+
+static const char * const filter_kind_names[] = {
+    [FILTER_UID] = "uid",
+    [FILTER_PID] = "pid",
+    [FILTER_PATH] = "path",
+};
+
+/* The rules as written, kept sorted so adding and deleting is a binary
+ * search and the path rules come out in the order the trie is built in.
+ */
+struct filter_ids {
+    u32 *ids;
+    u32 nr;
+    u32 cap;
+};
+
+struct filter_paths {
+    char **paths;
+    u32 nr;
+    u32 cap;
+};
+
+struct filter_rules {
+    struct filter_ids uids;
+    struct filter_ids pids;
+    struct filter_paths paths;
+};
+
+struct filter_slot {
+    u32 key;
+    u32 rule; // index of the rule in its filter_ids
+};
+
+struct filter_hash {
+    struct filter_slot *slots; // NULL when the kind has no rules
+    u32 bits;
+};
+
+/* One byte of a path rule. The children of a node are next to each other in
+ * the trie array, sorted by c.
+ */
+struct filter_trie_node {
+    u32 first;  // index of the first child
+    u16 nr;     // number of children
+    u8 c;
+    s32 rule;   // index of the path rule ending here, -1 if none does
+};
+
+struct filter_pcpu {
+    u64 misses[FILTER_KINDS];
+    u64 hits[]; // uid rules, then pid rules, then path rules
+};
+
+struct intercept_filter {
+    struct filter_rules rules;
+    struct filter_hash uids;
+    struct filter_hash pids;
+    struct filter_trie_node *trie; // NULL when there are no path rules
+    void *counters;                // a struct filter_pcpu row per possible CPU
+    size_t row_size;
+};
+
+DEFINE_STATIC_KEY_FALSE(intercept_filter_on);
+
+static struct intercept_filter __rcu *intercept_filter;
+
+/* Serializes changing the filter and reading /proc/intercept/filter */
+static DEFINE_MUTEX(filter_mutex);
+
+/* Rules written through an open file, applied when it is closed */
+struct filter_file {
+    struct filter_rules rules;
+    char line[FILTER_LINE_MAX];
+    size_t line_len;
+    int err;
+    bool changed; // rules changed since the open, so close installs them
+};
+
+/* Only one writer at a time, so two of them can not undo each other's changes */
+static unsigned long filter_writer;
+
+static struct proc_dir_entry *filter_proc_file;
+
+static struct filter_pcpu *filter_row(struct intercept_filter *f, int cpu)
+{
+    return f->counters + cpu * f->row_size;
+}
+
+/* The hook counts into the row of the CPU it runs on */
+static void filter_miss(struct intercept_filter *f, int kind)
+{
+    filter_row(f, get_cpu())->misses[kind]++;
+    put_cpu();
+}
+
+static void filter_hit(struct intercept_filter *f, u32 rule)
+{
+    filter_row(f, get_cpu())->hits[rule]++;
+    put_cpu();
+}
+
+static int filter_hash_lookup(const struct filter_hash *h, u32 key)
+{
+    u32 mask = (1U << h->bits) - 1;
+    u32 i;
+
+    /* At most half the slots are used, so the probe always ends */
+    for (i = hash_32(key, h->bits);; i = (i + 1) & mask) {
+        if (h->slots[i].key == key)
+            return h->slots[i].rule;
+        if (h->slots[i].key == FILTER_EMPTY)
+            return -1;
+    }
+}
+
+/* Longest path rule that is a prefix of path, or -1 */
+static int filter_trie_match(const struct filter_trie_node *trie, const char *path)
+{
+    const struct filter_trie_node *n = trie;
+    int match = -1;
+    u32 lo, hi, mid;
+    u8 c;
+
+    for (; *path; path++) {
+        c = *path;
+        lo = n->first;
+        hi = n->first + n->nr;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (trie[mid].c < c)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == n->first + n->nr || trie[lo].c != c)
+            break;
+
+        n = &trie[lo];
+        if (n->rule >= 0)
+            match = n->rule;
+    }
+    return match;
+}
+
+static bool filter_id_match(struct intercept_filter *f, int kind, const struct filter_hash *h,
+                            u32 key, u32 first)
+{
+    int rule;
+
+    if (!h->slots)
+        return true;
+
+    rule = filter_hash_lookup(h, key);
+    if (rule < 0) {
+        filter_miss(f, kind);
+        return false;
+    }
+    filter_hit(f, first + rule);
+    return true;
+}
+
+/* Called by the hook, before it copies the path, with the caller's real uid
+ * and thread group id. Only called while intercept_filter_on is set.
+ */
+bool intercept_filter_task(u32 uid, u32 pid)
+{
+    struct intercept_filter *f;
+    bool pass = true;
+
+    rcu_read_lock();
+    f = rcu_dereference(intercept_filter);
+    if (f)
+        pass = filter_id_match(f, FILTER_UID, &f->uids, uid, 0) &&
+               filter_id_match(f, FILTER_PID, &f->pids, pid, f->rules.uids.nr);
+    rcu_read_unlock();
+
+    return pass;
+}
+
+/* Called by the hook with the copied path, once intercept_filter_task let
+ * the call through.
+ */
+bool intercept_filter_path(const char *path)
+{
+    struct intercept_filter *f;
+    bool pass = true;
+    int rule;
+
+    rcu_read_lock();
+    f = rcu_dereference(intercept_filter);
+    if (f && f->trie) {
+        rule = filter_trie_match(f->trie, path);
+        if (rule < 0) {
+            filter_miss(f, FILTER_PATH);
+            pass = false;
+        } else {
+            filter_hit(f, f->rules.uids.nr + f->rules.pids.nr + rule);
+        }
+    }
+    rcu_read_unlock();
+
+    return pass;
+}
+
+/* Makes room for one more element in a rules array */
+static int filter_grow(void **arr, u32 *cap, u32 nr, size_t size)
+{
+    u32 new_cap;
+    void *n;
+
+    if (nr < *cap)
+        return 0;
+    if (nr >= FILTER_RULES_MAX)
+        return -ENOSPC;
+
+    new_cap = max(16U, *cap * 2);
+    n = kvmalloc_array(new_cap, size, GFP_KERNEL);
+    if (!n)
+        return -ENOMEM;
+    if (*arr)
+        memcpy(n, *arr, nr * size);
+    kvfree(*arr);
+    *arr = n;
+    *cap = new_cap;
+    return 0;
+}
+
+/* Index of key in the sorted ids, or where it would go */
+static u32 filter_ids_find(const struct filter_ids *s, u32 key, bool *found)
+{
+    u32 lo = 0, hi = s->nr, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (s->ids[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < s->nr && s->ids[lo] == key;
+    return lo;
+}
+
+static int filter_ids_add(struct filter_ids *s, u32 key)
+{
+    bool found;
+    u32 i = filter_ids_find(s, key, &found);
+    int ret;
+
+    if (found)
+        return 0;
+
+    ret = filter_grow((void **)&s->ids, &s->cap, s->nr, sizeof(*s->ids));
+    if (ret)
+        return ret;
+
+    memmove(&s->ids[i + 1], &s->ids[i], (s->nr - i) * sizeof(*s->ids));
+    s->ids[i] = key;
+    s->nr++;
+    return 0;
+}
+
+static void filter_ids_del(struct filter_ids *s, u32 key)
+{
+    bool found;
+    u32 i = filter_ids_find(s, key, &found);
+
+    if (!found)
+        return;
+
+    s->nr--;
+    memmove(&s->ids[i], &s->ids[i + 1], (s->nr - i) * sizeof(*s->ids));
+}
+
+static u32 filter_paths_find(const struct filter_paths *s, const char *path, bool *found)
+{
+    u32 lo = 0, hi = s->nr, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (strcmp(s->paths[mid], path) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < s->nr && !strcmp(s->paths[lo], path);
+    return lo;
+}
+
+static int filter_paths_add(struct filter_paths *s, const char *path)
+{
+    bool found;
+    u32 i = filter_paths_find(s, path, &found);
+    char *p;
+    int ret;
+
+    if (found)
+        return 0;
+
+    ret = filter_grow((void **)&s->paths, &s->cap, s->nr, sizeof(*s->paths));
+    if (ret)
+        return ret;
+
+    p = kstrdup(path, GFP_KERNEL);
+    if (!p)
+        return -ENOMEM;
+
+    memmove(&s->paths[i + 1], &s->paths[i], (s->nr - i) * sizeof(*s->paths));
+    s->paths[i] = p;
+    s->nr++;
+    return 0;
+}
+
+static void filter_paths_del(struct filter_paths *s, const char *path)
+{
+    bool found;
+    u32 i = filter_paths_find(s, path, &found);
+
+    if (!found)
+        return;
+
+    kfree(s->paths[i]);
+    s->nr--;
+    memmove(&s->paths[i], &s->paths[i + 1], (s->nr - i) * sizeof(*s->paths));
+}
+
+static u32 filter_rules_nr(const struct filter_rules *r)
+{
+    return r->uids.nr + r->pids.nr + r->paths.nr;
+}
+
+static void filter_rules_free(struct filter_rules *r)
+{
+    u32 i;
+
+    kvfree(r->uids.ids);
+    kvfree(r->pids.ids);
+    for (i = 0; i < r->paths.nr; i++)
+        kfree(r->paths.paths[i]);
+    kvfree(r->paths.paths);
+    memset(r, 0, sizeof(*r));
+}
+
+static int filter_rules_copy(struct filter_rules *dst, const struct filter_rules *src)
+{
+    u32 i;
+    int ret;
+
+    for (i = 0; i < src->uids.nr; i++) {
+        ret = filter_ids_add(&dst->uids, src->uids.ids[i]);
+        if (ret)
+            return ret;
+    }
+    for (i = 0; i < src->pids.nr; i++) {
+        ret = filter_ids_add(&dst->pids, src->pids.ids[i]);
+        if (ret)
+            return ret;
+    }
+    for (i = 0; i < src->paths.nr; i++) {
+        ret = filter_paths_add(&dst->paths, src->paths.paths[i]);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+static int filter_hash_build(struct filter_hash *h, const struct filter_ids *s)
+{
+    u32 i, j, mask;
+
+    if (!s->nr)
+        return 0;
+
+    h->bits = ilog2(roundup_pow_of_two(s->nr * 2));
+    h->slots = kvmalloc_array(1U << h->bits, sizeof(*h->slots), GFP_KERNEL);
+    if (!h->slots)
+        return -ENOMEM;
+
+    mask = (1U << h->bits) - 1;
+    for (i = 0; i <= mask; i++)
+        h->slots[i].key = FILTER_EMPTY;
+
+    for (i = 0; i < s->nr; i++) {
+        for (j = hash_32(s->ids[i], h->bits); h->slots[j].key != FILTER_EMPTY; j = (j + 1) & mask)
+            ;
+        h->slots[j].key = s->ids[i];
+        h->slots[j].rule = i;
+    }
+    return 0;
+}
+
+/* Builds the trie breadth first from the sorted path rules: the rules below
+ * a node are a contiguous range of them, and the children of the node are
+ * the runs of equal bytes at the node's depth in that range. Breadth first,
+ * the children of a node get consecutive slots, and no recursion (path rules
+ * are up to INTERCEPT_PATH_MAX bytes deep).
+ */
+struct filter_trie_work {
+    u32 node;
+    u32 lo;
+    u32 hi;
+    u32 depth;
+};
+
+static int filter_trie_build(struct intercept_filter *f)
+{
+    const struct filter_paths *s = &f->rules.paths;
+    struct filter_trie_work *queue, w;
+    struct filter_trie_node *n;
+    u32 max_nodes = 1, nodes = 1, head = 0, tail = 0;
+    u32 lo, hi, i;
+    u8 c;
+
+    if (!s->nr)
+        return 0;
+
+    for (i = 0; i < s->nr; i++)
+        max_nodes += strlen(s->paths[i]);
+
+    f->trie = kvmalloc_array(max_nodes, sizeof(*f->trie), GFP_KERNEL);
+    queue = kvmalloc_array(max_nodes, sizeof(*queue), GFP_KERNEL);
+    if (!f->trie || !queue) {
+        kvfree(queue);
+        return -ENOMEM;
+    }
+
+    f->trie[0].c = 0;
+    queue[tail++] = (struct filter_trie_work){ .node = 0, .lo = 0, .hi = s->nr, .depth = 0 };
+
+    while (head < tail) {
+        w = queue[head++];
+        n = &f->trie[w.node];
+        n->rule = -1;
+        n->first = nodes;
+        n->nr = 0;
+
+        lo = w.lo;
+        /* Sorted, a rule that ends at this depth comes first in the range */
+        if (s->paths[lo][w.depth] == '\0')
+            n->rule = lo++;
+
+        while (lo < w.hi) {
+            c = s->paths[lo][w.depth];
+            for (hi = lo + 1; hi < w.hi && (u8)s->paths[hi][w.depth] == c; hi++)
+                ;
+            f->trie[nodes].c = c;
+            queue[tail++] = (struct filter_trie_work){
+                .node = nodes, .lo = lo, .hi = hi, .depth = w.depth + 1
+            };
+            nodes++;
+            n->nr++;
+            lo = hi;
+        }
+    }
+
+    kvfree(queue);
+    return 0;
+}
+
+static void filter_free(struct intercept_filter *f)
+{
+    if (!f)
+        return;
+
+    filter_rules_free(&f->rules);
+    kvfree(f->uids.slots);
+    kvfree(f->pids.slots);
+    kvfree(f->trie);
+    kvfree(f->counters);
+    kfree(f);
+}
+
+/* Builds a filter out of a copy of rules. Returns NULL when there are no
+ * rules at all.
+ */
+static struct intercept_filter *filter_build(const struct filter_rules *rules)
+{
+    u32 nr = filter_rules_nr(rules);
+    struct intercept_filter *f;
+    int ret;
+
+    if (!nr)
+        return NULL;
+
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f)
+        return ERR_PTR(-ENOMEM);
+
+    ret = filter_rules_copy(&f->rules, rules);
+    if (ret) {
+        filter_free(f);
+        return ERR_PTR(ret);
+    }
+
+    if (filter_hash_build(&f->uids, &f->rules.uids) ||
+        filter_hash_build(&f->pids, &f->rules.pids) ||
+        filter_trie_build(f))
+        goto nomem;
+
+    f->row_size = ALIGN(offsetof(struct filter_pcpu, hits) + nr * sizeof(u64), SMP_CACHE_BYTES);
+    f->counters = kvcalloc(nr_cpu_ids, f->row_size, GFP_KERNEL);
+    if (!f->counters)
+        goto nomem;
+
+    return f;
+
+nomem:
+    filter_free(f);
+    return ERR_PTR(-ENOMEM);
+}
+
+/* Installs f (NULL removes the filter) and frees the old one once no hook
+ * can be looking at it any more. The static key is only on while there is a
+ * filter, so the hook never sees it on with no filter installed.
+ */
+static void filter_publish(struct intercept_filter *f)
+{
+    struct intercept_filter *old;
+
+    mutex_lock(&filter_mutex);
+    old = rcu_dereference_protected(intercept_filter, lockdep_is_held(&filter_mutex));
+    if (!f)
+        static_branch_disable(&intercept_filter_on);
+    rcu_assign_pointer(intercept_filter, f);
+    if (f)
+        static_branch_enable(&intercept_filter_on);
+    mutex_unlock(&filter_mutex);
+
+    synchronize_rcu();
+    filter_free(old);
+}
+
+/* One line written to /proc/intercept/filter */
+static int filter_parse_cmd(struct filter_rules *r, char *line)
+{
+    struct filter_ids *ids;
+    char *cmd, *kind;
+    bool add;
+    int ret;
+    u32 id;
+
+    cmd = strsep(&line, " ");
+    if (!*cmd)
+        return 0; // empty line
+
+    if (!strcmp(cmd, "clear")) {
+        filter_rules_free(r);
+        return 0;
+    }
+
+    if (!strcmp(cmd, "add"))
+        add = true;
+    else if (!strcmp(cmd, "del"))
+        add = false;
+    else
+        return -EINVAL;
+
+    kind = strsep(&line, " ");
+    if (!line || !*line)
+        return -EINVAL;
+
+    if (!strcmp(kind, "path")) {
+        /* A longer prefix could never match a path the hook cut short */
+        if (strlen(line) >= INTERCEPT_PATH_MAX)
+            return -EINVAL;
+        if (!add) {
+            filter_paths_del(&r->paths, line);
+            return 0;
+        }
+        ret = filter_paths_add(&r->paths, line);
+        if (!ret && filter_rules_nr(r) > FILTER_RULES_MAX) {
+            filter_paths_del(&r->paths, line);
+            ret = -ENOSPC;
+        }
+        return ret;
+    }
+
+    if (!strcmp(kind, "uid"))
+        ids = &r->uids;
+    else if (!strcmp(kind, "pid"))
+        ids = &r->pids;
+    else
+        return -EINVAL;
+
+    if (kstrtou32(line, 0, &id) || id == FILTER_EMPTY)
+        return -EINVAL;
+
+    if (!add) {
+        filter_ids_del(ids, id);
+        return 0;
+    }
+    ret = filter_ids_add(ids, id);
+    if (!ret && filter_rules_nr(r) > FILTER_RULES_MAX) {
+        filter_ids_del(ids, id);
+        ret = -ENOSPC;
+    }
+    return ret;
+}
+
+/* Takes the full lines of the write into the open file's rules; what
+ * follows the last newline waits for the next write (or the close).
+ */
+static ssize_t filter_write(struct file *file, const char __user *buffer, size_t len, loff_t *offset)
+{
+    struct filter_file *ff = file->private_data;
+    size_t n = min_t(size_t, len, FILTER_WRITE_MAX);
+    char *buf, *cur, *end, *nl;
+    size_t chunk;
+    ssize_t ret = n;
+
+    if (ff->err)
+        return ff->err;
+
+    buf = kvmalloc(n, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    if (copy_from_user(buf, buffer, n)) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    for (cur = buf, end = buf + n; cur < end; cur += chunk) {
+        nl = memchr(cur, '\n', end - cur);
+        chunk = (nl ? nl : end) - cur;
+
+        if (ff->line_len + chunk >= sizeof(ff->line)) {
+            ff->err = -EINVAL; // a single line longer than FILTER_LINE_MAX
+            break;
+        }
+        memcpy(ff->line + ff->line_len, cur, chunk);
+        ff->line_len += chunk;
+
+        if (!nl)
+            break;
+        chunk++; // the newline
+
+        ff->line[ff->line_len] = '\0';
+        ff->line_len = 0;
+        ff->err = filter_parse_cmd(&ff->rules, ff->line);
+        if (ff->err)
+            break;
+        ff->changed = true;
+    }
+
+    if (ff->err)
+        ret = ff->err;
+out:
+    kvfree(buf);
+    return ret;
+}
+
+/* seq_file iteration of /proc/intercept/filter: the counters of every kind,
+ * then one line per rule. The filter can not change while filter_mutex is
+ * held, from start to stop.
+ */
+static void *filter_seq_start(struct seq_file *m, loff_t *pos)
+{
+    struct intercept_filter *f;
+
+    mutex_lock(&filter_mutex);
+    f = rcu_dereference_protected(intercept_filter, lockdep_is_held(&filter_mutex));
+    m->private = f;
+
+    if (*pos == 0)
+        return SEQ_START_TOKEN;
+    if (!f || *pos > filter_rules_nr(&f->rules))
+        return NULL;
+    return pos;
+}
+
+static void *filter_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+    struct intercept_filter *f = m->private;
+
+    ++*pos;
+    if (!f || *pos > filter_rules_nr(&f->rules))
+        return NULL;
+    return pos;
+}
+
+static void filter_seq_stop(struct seq_file *m, void *v)
+{
+    mutex_unlock(&filter_mutex);
+}
+
+static u64 filter_sum(struct intercept_filter *f, u32 first, u32 nr)
+{
+    u64 sum = 0;
+    u32 i;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        for (i = first; i < first + nr; i++)
+            sum += filter_row(f, cpu)->hits[i];
+    return sum;
+}
+
+static int filter_seq_show(struct seq_file *m, void *v)
+{
+    struct intercept_filter *f = m->private;
+    u32 nr[FILTER_KINDS], first = 0, rule;
+    u64 misses;
+    int kind, cpu;
+
+    if (!f) {
+        seq_puts(m, "no filter, reporting the uid parameter\n");
+        return 0;
+    }
+
+    nr[FILTER_UID] = f->rules.uids.nr;
+    nr[FILTER_PID] = f->rules.pids.nr;
+    nr[FILTER_PATH] = f->rules.paths.nr;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_puts(m, "kind\trules\thits\tmisses\n");
+        for (kind = 0; kind < FILTER_KINDS; kind++) {
+            misses = 0;
+            for_each_possible_cpu(cpu)
+                misses += filter_row(f, cpu)->misses[kind];
+            seq_printf(m, "%s\t%u\t%llu\t%llu\n", filter_kind_names[kind], nr[kind],
+                       filter_sum(f, first, nr[kind]), misses);
+            first += nr[kind];
+        }
+        seq_puts(m, "\nkind\trule\thits\n");
+        return 0;
+    }
+
+    rule = *(loff_t *)v - 1;
+    for (kind = 0; rule >= nr[kind]; kind++)
+        rule -= nr[kind];
+
+    seq_printf(m, "%s\t", filter_kind_names[kind]);
+    if (kind == FILTER_UID)
+        seq_printf(m, "%u", f->rules.uids.ids[rule]);
+    else if (kind == FILTER_PID)
+        seq_printf(m, "%u", f->rules.pids.ids[rule]);
+    else
+        seq_puts(m, f->rules.paths.paths[rule]);
+    seq_printf(m, "\t%llu\n", filter_sum(f, *(loff_t *)v - 1, 1));
+    return 0;
+}
+
+static const struct seq_operations filter_seq_ops = {
+    .start = filter_seq_start,
+    .next = filter_seq_next,
+    .stop = filter_seq_stop,
+    .show = filter_seq_show,
+};
+
+/* Opened for reading it shows the filter, opened for writing it starts from
+ * the rules installed now.
+ */
+static int filter_open(struct inode *inode, struct file *file)
+{
+    struct intercept_filter *f;
+    struct filter_file *ff;
+    int ret;
+
+    if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE))
+        return -EINVAL;
+    if (file->f_mode & FMODE_READ)
+        return seq_open(file, &filter_seq_ops);
+
+    if (test_and_set_bit_lock(0, &filter_writer))
+        return -EBUSY;
+
+    ff = kzalloc(sizeof(*ff), GFP_KERNEL);
+    if (!ff) {
+        ret = -ENOMEM;
+        goto unlock;
+    }
+
+    mutex_lock(&filter_mutex);
+    f = rcu_dereference_protected(intercept_filter, lockdep_is_held(&filter_mutex));
+    ret = f ? filter_rules_copy(&ff->rules, &f->rules) : 0;
+    mutex_unlock(&filter_mutex);
+    if (ret) {
+        filter_rules_free(&ff->rules);
+        kfree(ff);
+        goto unlock;
+    }
+
+    file->private_data = ff;
+    return 0;
+
+unlock:
+    clear_bit_unlock(0, &filter_writer);
+    return ret;
+}
+
+static int filter_release(struct inode *inode, struct file *file)
+{
+    struct filter_file *ff = file->private_data;
+    struct intercept_filter *f;
+
+    if (file->f_mode & FMODE_READ)
+        return seq_release(inode, file);
+
+    /* A write failed and said so, nothing of this open file is applied */
+    if (ff->err)
+        goto out;
+
+    /* A last line without a newline, like echo -n writes */
+    if (ff->line_len) {
+        ff->line[ff->line_len] = '\0';
+        ff->err = filter_parse_cmd(&ff->rules, ff->line);
+        ff->changed = true;
+    }
+
+    /* Built once, from all the rules written. Nobody hears about an error
+     * this late any more but the log.
+     */
+    if (!ff->err && ff->changed) {
+        f = filter_build(&ff->rules);
+        if (IS_ERR(f))
+            ff->err = PTR_ERR(f);
+        else
+            filter_publish(f);
+    }
+    if (ff->err)
+        pr_warn("/proc/intercept/filter: applying the rules failed with %d, nothing applied\n", ff->err);
+
+out:
+    filter_rules_free(&ff->rules);
+    kfree(ff);
+    clear_bit_unlock(0, &filter_writer);
+    return 0;
+}
+
+/* Only the reading side is a seq_file */
+static loff_t filter_lseek(struct file *file, loff_t offset, int whence)
+{
+    if (file->f_mode & FMODE_READ)
+        return seq_lseek(file, offset, whence);
+    return -ESPIPE;
+}
+
+#ifdef HAVE_PROC_OPS
+static const struct proc_ops filter_fops = {
+    .proc_open = filter_open,
+    .proc_read = seq_read,
+    .proc_write = filter_write,
+    .proc_lseek = filter_lseek,
+    .proc_release = filter_release,
+};
+#else
+static const struct file_operations filter_fops = {
+    .open = filter_open,
+    .read = seq_read,
+    .write = filter_write,
+    .llseek = filter_lseek,
+    .release = filter_release,
+};
+#endif
+
+int intercept_filter_init(void)
+{
+    filter_proc_file = proc_create("filter", 0600, intercept_proc_dir, &filter_fops);
+    if (!filter_proc_file) {
+        pr_alert("Error: Could not initialize /proc/intercept/filter\n");
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* Called once the hook is gone */
+void intercept_filter_exit(void)
+{
+    proc_remove(filter_proc_file);
+    filter_publish(NULL);
+}
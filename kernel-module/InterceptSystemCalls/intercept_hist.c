@@ -0,0 +1,334 @@
+/*
+* intercept_hist.c Latency histograms of the intercepted calls.
+*
+* With latency=1 the hook times the original call of every open it reports
+* and counts the time in a log2 histogram: bucket 0 holds calls that took
+* 0 ns (a clock that did not tick), bucket b calls that took [2^(b-1), 2^b) ns.
+* Every CPU has its own histograms, so timing a call costs two clock reads and
+* an increment of a counter nobody else writes. latency_split=uid keeps a
+* histogram for each of the first HIST_UIDS uids seen (the rest share one),
+* latency_split=flags one per kind of open (read only, write only, read write,
+* create).
+*
+* /proc/intercept/latency merges the CPUs and reports the count, p50, p99 and
+* p999 of every histogram (interpolated inside the bucket they fall into)
+* followed by its non empty buckets. Writing "reset" to it starts all of them
+* over; calls that finish while the counters are being cleared may be lost
+* or counted into the new histogram.
+*
+* Only the table and kprobe hook modes can time the call, the table hook
+* wraps it and the kprobe mode uses a kretprobe. The ftrace hook only sees
+* the entry.
+*/
+
+#include <linux/bitops.h>
+#include <linux/fcntl.h>
+#include <linux/jump_label.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+
+#include "intercept.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#define HAVE_PROC_OPS
+#endif
+
+#define HIST_BUCKETS 40 // the last one takes everything from 2^38 ns (4.5 minutes) on
+#define HIST_UIDS 16
+#define HIST_MAX (HIST_UIDS + 1)
+#define HIST_NO_UID ((u32)-1)
+
+/* latency=1 times the original call of every reported open. The check in the
+ * hook is a static key, so it costs nothing while off.
+ */
+DEFINE_STATIC_KEY_FALSE(intercept_latency);
+
+static int latency_param_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(val, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        static_branch_enable(&intercept_latency);
+    else
+        static_branch_disable(&intercept_latency);
+    return 0;
+}
+
+static int latency_param_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&intercept_latency) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops latency_param_ops = {
+    .set = latency_param_set,
+    .get = latency_param_get,
+};
+module_param_cb(latency, &latency_param_ops, NULL, 0644);
+MODULE_PARM_DESC(latency, "Histogram the latency of the reported calls in /proc/intercept/latency (default N)");
+
+enum hist_split {
+    SPLIT_NONE,
+    SPLIT_UID,
+    SPLIT_FLAGS,
+};
+
+static const char * const hist_split_names[] = {
+    [SPLIT_NONE] = "none",
+    [SPLIT_UID] = "uid",
+    [SPLIT_FLAGS] = "flags",
+};
+
+static char *latency_split_param = "none";
+module_param_named(latency_split, latency_split_param, charp, 0444);
+MODULE_PARM_DESC(latency_split, "One histogram in total (none), per uid (uid) or per kind of open (flags)");
+
+static int hist_split;
+
+static const char * const hist_flags_names[] = { "rdonly", "wronly", "rdwr", "creat" };
+
+struct hist_pcpu {
+    u64 buckets[HIST_MAX][HIST_BUCKETS];
+};
+
+static struct hist_pcpu __percpu *hists;
+
+/* The uid of every per uid histogram, HIST_NO_UID while it is unused */
+static u32 hist_uids[HIST_UIDS];
+
+static struct proc_dir_entry *latency_proc_file;
+
+static unsigned int hist_nr(void)
+{
+    switch (hist_split) {
+    case SPLIT_UID:
+        return HIST_MAX;
+    case SPLIT_FLAGS:
+        return ARRAY_SIZE(hist_flags_names);
+    default:
+        return 1;
+    }
+}
+
+/* The histogram of the uid, taking a free one the first time the uid shows up */
+static unsigned int hist_of_uid(u32 uid)
+{
+    unsigned int i;
+    u32 cur;
+
+    for (i = 0; i < HIST_UIDS; i++) {
+        cur = READ_ONCE(hist_uids[i]);
+        if (cur == HIST_NO_UID)
+            cur = cmpxchg(&hist_uids[i], HIST_NO_UID, uid) == HIST_NO_UID ? uid : hist_uids[i];
+        if (cur == uid)
+            return i;
+    }
+    return HIST_UIDS; // everybody else
+}
+
+static unsigned int hist_of(u32 uid, int flags)
+{
+    switch (hist_split) {
+    case SPLIT_UID:
+        return hist_of_uid(uid);
+    case SPLIT_FLAGS:
+        if (flags & O_CREAT)
+            return 3;
+        /* O_ACCMODE 3 is not a valid mode, count it as read write */
+        return min(flags & O_ACCMODE, O_RDWR);
+    default:
+        return 0;
+    }
+}
+
+/* Called by the hook when the original call returned, ns after it started */
+void intercept_hist_record(u64 ns, u32 uid, int flags)
+{
+    unsigned int b = min_t(unsigned int, fls64(ns), HIST_BUCKETS - 1);
+
+    this_cpu_inc(hists->buckets[hist_of(uid, flags)][b]);
+}
+
+static u64 bucket_lower(unsigned int b)
+{
+    return b ? 1ULL << (b - 1) : 0;
+}
+
+static u64 bucket_upper(unsigned int b)
+{
+    return 1ULL << b;
+}
+
+/* The latency below which per10k / 10000 of the calls finished, assuming
+ * they are spread evenly over the bucket the rank falls into.
+ */
+static u64 hist_percentile(const u64 *buckets, u64 total, unsigned int per10k)
+{
+    u64 rank = div64_u64(total * per10k + 9999, 10000);
+    u64 seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        if (seen + buckets[b] >= rank)
+            return bucket_lower(b) + div64_u64((bucket_upper(b) - bucket_lower(b)) * (rank - seen),
+                                               buckets[b]);
+        seen += buckets[b];
+    }
+    return bucket_upper(HIST_BUCKETS - 1);
+}
+
+static void hist_name(struct seq_file *m, unsigned int h)
+{
+    switch (hist_split) {
+    case SPLIT_UID:
+        if (h == HIST_UIDS)
+            seq_puts(m, "other");
+        else
+            seq_printf(m, "uid=%u", READ_ONCE(hist_uids[h]));
+        break;
+    case SPLIT_FLAGS:
+        seq_puts(m, hist_flags_names[h]);
+        break;
+    default:
+        seq_puts(m, "all");
+    }
+}
+
+static int latency_show(struct seq_file *m, void *v)
+{
+    u64 merged[HIST_BUCKETS], total;
+    unsigned int h, b;
+    bool header = false;
+    int cpu;
+
+    seq_puts(m, "hist\tcount\tp50_ns\tp99_ns\tp999_ns\n");
+    for (h = 0; h < hist_nr(); h++) {
+        if (hist_split == SPLIT_UID && h < HIST_UIDS && READ_ONCE(hist_uids[h]) == HIST_NO_UID)
+            continue;
+
+        memset(merged, 0, sizeof(merged));
+        total = 0;
+        for_each_possible_cpu(cpu)
+            for (b = 0; b < HIST_BUCKETS; b++)
+                merged[b] += per_cpu_ptr(hists, cpu)->buckets[h][b];
+        for (b = 0; b < HIST_BUCKETS; b++)
+            total += merged[b];
+        if (!total)
+            continue;
+
+        hist_name(m, h);
+        seq_printf(m, "\t%llu\t%llu\t%llu\t%llu\n", total, hist_percentile(merged, total, 5000),
+                   hist_percentile(merged, total, 9900), hist_percentile(merged, total, 9990));
+    }
+
+    for (h = 0; h < hist_nr(); h++) {
+        if (hist_split == SPLIT_UID && h < HIST_UIDS && READ_ONCE(hist_uids[h]) == HIST_NO_UID)
+            continue;
+
+        for (b = 0; b < HIST_BUCKETS; b++) {
+            total = 0;
+            for_each_possible_cpu(cpu)
+                total += per_cpu_ptr(hists, cpu)->buckets[h][b];
+            if (!total)
+                continue;
+
+            if (!header) {
+                seq_puts(m, "\nhist\tfrom_ns\tto_ns\tcount\n");
+                header = true;
+            }
+            hist_name(m, h);
+            seq_printf(m, "\t%llu\t%llu\t%llu\n", bucket_lower(b), bucket_upper(b), total);
+        }
+    }
+    return 0;
+}
+
+static void hist_reset(void)
+{
+    int cpu;
+
+    memset(hist_uids, 0xff, sizeof(hist_uids)); // HIST_NO_UID
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(hists, cpu), 0, sizeof(struct hist_pcpu));
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, latency_show, NULL);
+}
+
+/* "reset" clears every histogram */
+static ssize_t latency_write(struct file *file, const char __user *buffer, size_t len, loff_t *offset)
+{
+    char cmd[8];
+    size_t n = min(len, sizeof(cmd) - 1);
+
+    if (copy_from_user(cmd, buffer, n))
+        return -EFAULT;
+    cmd[n] = '\0';
+
+    if (!sysfs_streq(cmd, "reset"))
+        return -EINVAL;
+
+    hist_reset();
+    return len;
+}
+
+#ifdef HAVE_PROC_OPS
+static const struct proc_ops latency_fops = {
+    .proc_open = latency_open,
+    .proc_read = seq_read,
+    .proc_write = latency_write,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+#else
+static const struct file_operations latency_fops = {
+    .open = latency_open,
+    .read = seq_read,
+    .write = latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+#endif
+
+int intercept_hist_init(void)
+{
+    hist_split = match_string(hist_split_names, ARRAY_SIZE(hist_split_names), latency_split_param);
+    if (hist_split < 0) {
+        pr_alert("Error: unknown latency_split %s\n", latency_split_param);
+        return -EINVAL;
+    }
+
+    hists = alloc_percpu(struct hist_pcpu);
+    if (!hists)
+        return -ENOMEM;
+    hist_reset();
+
+    latency_proc_file = proc_create("latency", 0600, intercept_proc_dir, &latency_fops);
+    if (!latency_proc_file) {
+        pr_alert("Error: Could not initialize /proc/intercept/latency\n");
+        free_percpu(hists);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* Called once the hook is gone */
+void intercept_hist_exit(void)
+{
+    proc_remove(latency_proc_file);
+    free_percpu(hists);
+}
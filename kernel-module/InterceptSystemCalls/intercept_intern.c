@@ -0,0 +1,426 @@
+/*
+* intercept_intern.c Path interning: events name a path by a small id.
+*
+* The same few thousand paths are opened over and over, and every event used
+* to carry its path, up to INTERCEPT_PATH_MAX bytes of it. With
+* intern_paths=1 the hook looks the path it copied up in a hash table keyed
+* by its content hash; the event then carries the path's id (path_id, with
+* INTERCEPT_EVENT_INTERNED) and no path, so a netlink record shrinks to its
+* fixed part and a ring slot is filled with zeros instead of the path. A path not seen before gets the next id, and a
+* record of it (struct intercept_path_record) is queued on the dictionary
+* stream before the id can show up in any event.
+*
+* The dictionary holds at most intern_entries paths. It is approximately LRU:
+* a hit only marks its entry referenced, without a lock or a write when the
+* mark is already set, and a new path evicts the first unreferenced entry
+* the clock hand finds, clearing the marks it passes (the clock algorithm).
+* Lookups run under RCU, inserts and evictions take intern_lock and free the
+* evicted entry after a grace period.
+*
+* The dictionary stream is a record fifo of INTERN_FIFO_SIZE bytes, drained
+* by /dev/intercept_paths (one reader, like /dev/intercept), or by the
+* netlink flush when netlink=1. When it has no room for a new path, the path
+* is not interned and the event carries it as before, so no id ever reaches
+* a consumer without its record. /proc/intercept/paths shows the counters
+* and the paths currently in the dictionary.
+*/
+
+#include <linux/fs.h>
+#include <linux/jump_label.h>
+#include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/proc_fs.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/stringhash.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include "intercept.h"
+
+#define DEVICE_NAME "intercept_paths"
+
+#define INTERN_FIFO_SIZE 65536
+
+/* intern_paths=1 replaces known paths in the events by their id. The check
+ * in the hook is a static key, so it costs nothing while off.
+ */
+DEFINE_STATIC_KEY_FALSE(intercept_intern);
+
+static int intern_param_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(val, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        static_branch_enable(&intercept_intern);
+    else
+        static_branch_disable(&intercept_intern);
+    return 0;
+}
+
+static int intern_param_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&intercept_intern) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops intern_param_ops = {
+    .set = intern_param_set,
+    .get = intern_param_get,
+};
+module_param_cb(intern_paths, &intern_param_ops, NULL, 0644);
+MODULE_PARM_DESC(intern_paths, "Send known paths as ids, with a dictionary stream (default N)");
+
+static unsigned int intern_entries = 4096;
+module_param(intern_entries, uint, 0444);
+MODULE_PARM_DESC(intern_entries, "Most paths in the dictionary at a time (default 4096)");
+
+struct intern_entry {
+    struct hlist_node node;
+    struct list_head clock;
+    struct rcu_head rcu;
+    u32 hash;
+    u32 id;
+    bool referenced;
+    u16 len;
+    char path[]; // NUL terminated
+};
+
+/* Everything below intern_lock is only changed with it held. The hook is the
+ * only one taking it, never from an interrupt.
+ */
+static DEFINE_SPINLOCK(intern_lock);
+static struct hlist_head *intern_buckets;
+static u32 intern_mask;
+static LIST_HEAD(intern_clock);          // every entry, in the order the hand visits them
+static struct list_head *intern_hand = &intern_clock;
+static unsigned int intern_nr;
+static u32 intern_next_id = 1;
+
+/* The dictionary stream. Only intern_lock holders put records in, and only
+ * intern_read_mutex holders take them out, which is all a kfifo needs.
+ */
+static STRUCT_KFIFO_REC_2(INTERN_FIFO_SIZE) intern_fifo;
+static DEFINE_MUTEX(intern_read_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(intern_wait);
+
+/* /dev/intercept_paths has a single reader, so only one open at a time */
+static unsigned long intern_busy;
+
+struct intern_stats {
+    u64 hits;
+    u64 added;
+    u64 evicted;
+    u64 fallbacks; // paths sent whole: no memory, or no room in the stream
+};
+
+static DEFINE_PER_CPU(struct intern_stats, intern_stats);
+
+static struct proc_dir_entry *paths_proc_file;
+
+static struct intern_entry *intern_find(u32 hash, const char *path, u16 len)
+{
+    struct intern_entry *e;
+
+    hlist_for_each_entry_rcu(e, &intern_buckets[hash & intern_mask], node)
+        if (e->hash == hash && e->len == len && !memcmp(e->path, path, len))
+            return e;
+    return NULL;
+}
+
+/* Queues a record on the dictionary stream, all or nothing */
+static bool intern_queue(u32 id, u16 kind, const char *path, u16 len)
+{
+    char buf[INTERCEPT_PATH_RECORD_LEN(INTERCEPT_PATH_MAX)] __aligned(8);
+    struct intercept_path_record *rec = (struct intercept_path_record *)buf;
+    size_t size = INTERCEPT_PATH_RECORD_LEN(len);
+
+    memset(buf, 0, size);
+    rec->id = id;
+    rec->kind = kind;
+    rec->path_len = len;
+    memcpy(rec->path, path, len);
+
+    return kfifo_in(&intern_fifo, buf, size) == size;
+}
+
+/* Makes room for one more entry, with intern_lock held */
+static void intern_evict(void)
+{
+    struct intern_entry *e;
+
+    for (;;) {
+        if (intern_hand == &intern_clock)
+            intern_hand = intern_hand->next;
+        e = list_entry(intern_hand, struct intern_entry, clock);
+        intern_hand = intern_hand->next;
+
+        if (READ_ONCE(e->referenced)) {
+            WRITE_ONCE(e->referenced, false);
+            continue;
+        }
+
+        hlist_del_rcu(&e->node);
+        list_del(&e->clock);
+        intern_nr--;
+        /* Without room for the record the consumer just keeps the path */
+        intern_queue(e->id, INTERCEPT_PATH_DEL, "", 0);
+        this_cpu_inc(intern_stats.evicted);
+        kfree_rcu(e, rcu);
+        return;
+    }
+}
+
+static u32 intern_insert(u32 hash, const char *path, u16 len)
+{
+    struct intern_entry *e;
+    u32 id = 0;
+
+    spin_lock(&intern_lock);
+
+    /* Somebody else may have added it since the lookup */
+    e = intern_find(hash, path, len);
+    if (e) {
+        id = e->id;
+        goto out;
+    }
+
+    e = kmalloc(sizeof(*e) + len + 1, GFP_ATOMIC);
+    if (!e)
+        goto out;
+
+    if (intern_nr >= intern_entries)
+        intern_evict();
+
+    e->hash = hash;
+    e->id = intern_next_id;
+    e->referenced = false;
+    e->len = len;
+    memcpy(e->path, path, len);
+    e->path[len] = '\0';
+
+    /* The record goes out before anybody can find the id */
+    if (!intern_queue(e->id, INTERCEPT_PATH_ADD, path, len)) {
+        kfree(e);
+        goto out;
+    }
+    intern_next_id++;
+
+    /* Just behind the hand, so it gets a full round before it is looked at */
+    list_add_tail(&e->clock, intern_hand);
+    hlist_add_head_rcu(&e->node, &intern_buckets[hash & intern_mask]);
+    intern_nr++;
+    id = e->id;
+    this_cpu_inc(intern_stats.added);
+    wake_up_interruptible(&intern_wait);
+out:
+    spin_unlock(&intern_lock);
+    return id;
+}
+
+/* Called by the hook with the copied path. Returns its id, or 0 when the
+ * event has to carry the path itself.
+ */
+u32 intercept_intern_path(const char *path, u16 len)
+{
+    u32 hash = full_name_hash(NULL, path, len);
+    struct intern_entry *e;
+    u32 id;
+
+    rcu_read_lock();
+    e = intern_find(hash, path, len);
+    if (e) {
+        if (!READ_ONCE(e->referenced))
+            WRITE_ONCE(e->referenced, true);
+        id = e->id;
+        rcu_read_unlock();
+        this_cpu_inc(intern_stats.hits);
+        return id;
+    }
+    rcu_read_unlock();
+
+    id = intern_insert(hash, path, len);
+    if (!id)
+        this_cpu_inc(intern_stats.fallbacks);
+    return id;
+}
+
+/* Takes as many whole dictionary records as fit into buf, for the
+ * /dev/intercept_paths reader or the netlink flush.
+ */
+size_t intercept_intern_drain(void *buf, size_t size)
+{
+    size_t done = 0;
+    unsigned int len;
+
+    mutex_lock(&intern_read_mutex);
+    while (!kfifo_is_empty(&intern_fifo)) {
+        len = kfifo_peek_len(&intern_fifo);
+        if (len > size - done)
+            break;
+        done += kfifo_out(&intern_fifo, buf + done, len);
+    }
+    mutex_unlock(&intern_read_mutex);
+    return done;
+}
+
+/* Returns whole records, blocks until there is at least one unless the file
+ * was opened O_NONBLOCK.
+ */
+static ssize_t intern_read(struct file *filp, char __user *buf, size_t count, loff_t *offset)
+{
+    size_t size = min_t(size_t, count, PAGE_SIZE);
+    void *page;
+    size_t n;
+    int ret;
+
+    if (size < INTERCEPT_PATH_RECORD_LEN(INTERCEPT_PATH_MAX))
+        return -EINVAL;
+
+    page = (void *)__get_free_page(GFP_KERNEL);
+    if (!page)
+        return -ENOMEM;
+
+    for (;;) {
+        n = intercept_intern_drain(page, size);
+        if (n) {
+            ret = copy_to_user(buf, page, n) ? -EFAULT : n;
+            break;
+        }
+
+        if (filp->f_flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            break;
+        }
+
+        ret = wait_event_interruptible(intern_wait, !kfifo_is_empty(&intern_fifo));
+        if (ret)
+            break;
+    }
+
+    free_page((unsigned long)page);
+    return ret;
+}
+
+static __poll_t intern_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    poll_wait(filp, &intern_wait, wait);
+    return kfifo_is_empty(&intern_fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static int intern_open(struct inode *inode, struct file *filp)
+{
+    if (test_and_set_bit_lock(0, &intern_busy))
+        return -EBUSY;
+
+    return stream_open(inode, filp);
+}
+
+static int intern_release(struct inode *inode, struct file *filp)
+{
+    clear_bit_unlock(0, &intern_busy);
+    return 0;
+}
+
+static const struct file_operations intern_fops = {
+    .owner = THIS_MODULE,
+    .open = intern_open,
+    .release = intern_release,
+    .read = intern_read,
+    .poll = intern_poll,
+};
+
+/* The paths other users open, so root only */
+static struct miscdevice intern_miscdev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = DEVICE_NAME,
+    .fops = &intern_fops,
+    .mode = 0400,
+};
+
+static int paths_show(struct seq_file *m, void *v)
+{
+    struct intern_stats sum = { 0 };
+    struct intern_entry *e;
+    u32 b;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        const struct intern_stats *s = per_cpu_ptr(&intern_stats, cpu);
+
+        sum.hits += s->hits;
+        sum.added += s->added;
+        sum.evicted += s->evicted;
+        sum.fallbacks += s->fallbacks;
+    }
+
+    seq_printf(m, "paths %u next_id %u hits %llu added %llu evicted %llu fallbacks %llu queued %u\n",
+               READ_ONCE(intern_nr), READ_ONCE(intern_next_id), sum.hits, sum.added, sum.evicted,
+               sum.fallbacks, kfifo_len(&intern_fifo));
+
+    rcu_read_lock();
+    for (b = 0; b <= intern_mask; b++)
+        hlist_for_each_entry_rcu(e, &intern_buckets[b], node)
+            seq_printf(m, "%u\t%s\n", e->id, e->path);
+    rcu_read_unlock();
+    return 0;
+}
+
+int intercept_intern_init(void)
+{
+    int ret;
+
+    intern_entries = clamp(intern_entries, 16U, 1U << 20);
+    intern_mask = roundup_pow_of_two(intern_entries) - 1;
+    intern_buckets = kvcalloc(intern_mask + 1, sizeof(*intern_buckets), GFP_KERNEL);
+    if (!intern_buckets)
+        return -ENOMEM;
+    INIT_KFIFO(intern_fifo);
+
+    paths_proc_file = proc_create_single("paths", 0400, intercept_proc_dir, paths_show);
+    if (!paths_proc_file) {
+        pr_alert("Error: Could not initialize /proc/intercept/paths\n");
+        ret = -ENOMEM;
+        goto free_buckets;
+    }
+
+    ret = misc_register(&intern_miscdev);
+    if (ret) {
+        pr_alert("Error: Could not register /dev/%s\n", DEVICE_NAME);
+        goto remove_proc;
+    }
+    return 0;
+
+remove_proc:
+    proc_remove(paths_proc_file);
+free_buckets:
+    kvfree(intern_buckets);
+    return ret;
+}
+
+/* Called once the hook is gone, nobody looks paths up any more */
+void intercept_intern_exit(void)
+{
+    struct intern_entry *e, *tmp;
+
+    misc_deregister(&intern_miscdev);
+    proc_remove(paths_proc_file);
+    list_for_each_entry_safe(e, tmp, &intern_clock, clock)
+        kfree(e);
+    /* The entries evicted earlier wait for kfree_rcu, but not on us */
+    kvfree(intern_buckets);
+}
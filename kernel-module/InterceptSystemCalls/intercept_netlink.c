@@ -0,0 +1,387 @@
+/*
+* intercept_netlink.c Generic netlink transport for the intercepted calls.
+*
+* /dev/intercept has a single consumer. With netlink=1 the hook hands its
+* events to the "events" multicast group of the "intercept" generic netlink
+* family instead, and every subscribed socket gets all of them; the
+* subscriber in intercept_subscribe.c shows how to join and decode them.
+*
+* Sending a message per event would cost an skb allocation and a broadcast
+* per call, so every CPU fills a batch: an skb allocated ahead of time, into
+* which the hook copies its event as a record of the INTERCEPT_ATTR_EVENTS
+* attribute (see intercept_uapi.h). Only the hook of that CPU and the flush
+* work take the per-CPU lock of a batch. The flush work swaps every non
+* empty batch for a fresh skb, sends the new path dictionary records, then
+* closes each batch it swapped out with the CPU, the number of records and
+* the counters, and multicasts it. It runs netlink_flush_ms after the
+* first event of a batch, or as soon as a batch is half full.
+*
+* Nothing waits for the subscribers. When a batch is full, or no fresh skb
+* could be allocated, the event is dropped and counted in INTERCEPT_ATTR_DROPS
+* of that CPU's next batch. A subscriber whose receive buffer is full misses
+* the batch, gets ENOBUFS from recv and sees a gap in INTERCEPT_ATTR_SEQ; the
+* module counts such batches in INTERCEPT_ATTR_OVERRUNS. /proc/intercept/netlink
+* shows the same counters.
+*/
+
+#include <linux/capability.h>
+#include <linux/jump_label.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/skbuff.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <net/genetlink.h>
+#include <net/net_namespace.h>
+
+#include "intercept.h"
+
+/* netlink=1 multicasts the events instead of recording them into the rings.
+ * The check in the hook is a static key, so it costs nothing while off.
+ */
+DEFINE_STATIC_KEY_FALSE(intercept_netlink);
+
+static int netlink_param_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(val, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        static_branch_enable(&intercept_netlink);
+    else
+        static_branch_disable(&intercept_netlink);
+    return 0;
+}
+
+static int netlink_param_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&intercept_netlink) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops netlink_param_ops = {
+    .set = netlink_param_set,
+    .get = netlink_param_get,
+};
+module_param_cb(netlink, &netlink_param_ops, NULL, 0644);
+MODULE_PARM_DESC(netlink, "Multicast the events over generic netlink instead of /dev/intercept (default N)");
+
+/* The length of an attribute is 16 bits, so a batch stays below 64 KiB */
+static unsigned int netlink_batch = 32768;
+module_param(netlink_batch, uint, 0444);
+MODULE_PARM_DESC(netlink_batch, "Bytes of events per netlink message and CPU (default 32768)");
+
+static unsigned int netlink_flush_ms = 100;
+module_param(netlink_flush_ms, uint, 0644);
+MODULE_PARM_DESC(netlink_flush_ms, "Most ms an event waits in its batch (default 100)");
+
+/* The events carry the paths other users open, so only root may join. Since
+ * v6.7 the group says so itself, before that the family checks every join.
+ */
+static const struct genl_multicast_group intercept_genl_mcgrps[] = {
+    {
+        .name = INTERCEPT_GENL_MCGRP,
+#ifdef GENL_MCAST_CAP_SYS_ADMIN
+        .flags = GENL_MCAST_CAP_SYS_ADMIN,
+#endif
+    },
+};
+
+#ifndef GENL_MCAST_CAP_SYS_ADMIN
+static int nl_mcast_bind(struct net *net, int group)
+{
+    return capable(CAP_SYS_ADMIN) ? 0 : -EPERM;
+}
+#endif
+
+static struct genl_family intercept_genl_family = {
+    .name = INTERCEPT_GENL_NAME,
+    .version = INTERCEPT_GENL_VERSION,
+    .maxattr = INTERCEPT_ATTR_MAX,
+    .module = THIS_MODULE,
+    .mcgrps = intercept_genl_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(intercept_genl_mcgrps),
+#ifndef GENL_MCAST_CAP_SYS_ADMIN
+    .mcast_bind = nl_mcast_bind,
+#endif
+};
+
+struct nl_batch {
+    spinlock_t lock;
+    struct sk_buff *skb;    // being filled, NULL when no fresh one could be allocated
+    void *hdr;              // the user header of the message, for genlmsg_end
+    struct nlattr *events;  // INTERCEPT_ATTR_EVENTS, its length is set on flush
+    u32 nr;
+    bool kicked;            // the flush work is asked to run right away
+    u64 drops;
+
+    /* What the flush swapped out and still has to send, only it uses these */
+    struct sk_buff *out;
+    void *out_hdr;
+    struct nlattr *out_events;
+    u32 out_nr;
+    u64 out_drops;
+};
+
+static DEFINE_PER_CPU(struct nl_batch, nl_batches);
+
+static void nl_flush(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nl_flush_work, nl_flush);
+
+/* Only the flush work, which never runs twice at once, writes these */
+static u64 nl_seq;
+static u64 nl_overruns;
+
+static struct proc_dir_entry *netlink_proc_file;
+
+/* What the flush puts after the records */
+static size_t nl_trailer_room(void)
+{
+    return 2 * nla_total_size(sizeof(u32)) + 3 * nla_total_size_64bit(sizeof(u64));
+}
+
+static struct sk_buff *nl_batch_alloc(void **hdr, struct nlattr **events)
+{
+    struct sk_buff *skb;
+
+    skb = genlmsg_new(netlink_batch, GFP_KERNEL);
+    if (!skb)
+        return NULL;
+
+    *hdr = genlmsg_put(skb, 0, 0, &intercept_genl_family, 0, INTERCEPT_CMD_EVENTS);
+    *events = *hdr ? nla_reserve(skb, INTERCEPT_ATTR_EVENTS, 0) : NULL;
+    if (!*events) {
+        kfree_skb(skb);
+        return NULL;
+    }
+    return skb;
+}
+
+static void nl_kick(unsigned long delay)
+{
+    if (delay)
+        schedule_delayed_work(&nl_flush_work, delay);
+    else
+        mod_delayed_work(system_wq, &nl_flush_work, 0);
+}
+
+/* Called by the hook with the caller's event, instead of
+ * intercept_event_record. Nobody subscribed, nothing to do.
+ */
+void intercept_netlink_record(const struct intercept_event *ev)
+{
+    size_t copy = offsetof(struct intercept_event, path) + ev->path_len + 1;
+    size_t len = INTERCEPT_EVENT_RECORD_LEN(ev->path_len);
+    struct nl_batch *b;
+    void *rec;
+
+    if (!genl_has_listeners(&intercept_genl_family, &init_net, 0))
+        return;
+
+    b = get_cpu_ptr(&nl_batches);
+    spin_lock(&b->lock);
+
+    if (!b->skb || skb_tailroom(b->skb) < len + nl_trailer_room()) {
+        b->drops++;
+        if (!b->kicked) {
+            b->kicked = true;
+            nl_kick(0);
+        }
+        goto out;
+    }
+
+    rec = skb_put(b->skb, len);
+    memcpy(rec, ev, copy);
+    memset(rec + copy, 0, len - copy);
+
+    if (!b->nr++)
+        nl_kick(msecs_to_jiffies(READ_ONCE(netlink_flush_ms)));
+    else if (!b->kicked && skb_tail_pointer(b->skb) - (unsigned char *)b->events > netlink_batch / 2) {
+        b->kicked = true;
+        nl_kick(0);
+    }
+out:
+    spin_unlock(&b->lock);
+    put_cpu_ptr(&nl_batches);
+}
+
+static void nl_send(struct sk_buff *skb, void *hdr, struct nlattr *events, int cpu, u32 nr, u64 drops)
+{
+    int ret;
+
+    events->nla_len = skb_tail_pointer(skb) - (unsigned char *)events;
+    if (nla_put_u32(skb, INTERCEPT_ATTR_CPU, cpu) ||
+        nla_put_u32(skb, INTERCEPT_ATTR_NR, nr) ||
+        nla_put_u64_64bit(skb, INTERCEPT_ATTR_SEQ, ++nl_seq, INTERCEPT_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, INTERCEPT_ATTR_DROPS, drops, INTERCEPT_ATTR_PAD) ||
+        nla_put_u64_64bit(skb, INTERCEPT_ATTR_OVERRUNS, nl_overruns, INTERCEPT_ATTR_PAD)) {
+        /* The hook keeps nl_trailer_room free, so this does not happen */
+        kfree_skb(skb);
+        return;
+    }
+    genlmsg_end(skb, hdr);
+
+    /* -ESRCH: nobody listens any more. -ENOBUFS: somebody's receive buffer
+     * is full, the others still got the batch.
+     */
+    ret = genlmsg_multicast(&intercept_genl_family, skb, 0, 0, GFP_KERNEL);
+    if (ret && ret != -ESRCH)
+        WRITE_ONCE(nl_overruns, nl_overruns + 1);
+}
+
+/* Sends the new dictionary records of intercept_intern.c. The flush calls it
+ * once every batch is swapped out, so the ADD record of every id in them is
+ * already queued and goes out before the batches.
+ */
+static void nl_send_paths(void)
+{
+    struct sk_buff *skb;
+    struct nlattr *paths;
+    void *hdr;
+    size_t n;
+    int ret;
+
+    for (;;) {
+        skb = genlmsg_new(netlink_batch, GFP_KERNEL);
+        if (!skb)
+            return;
+
+        /* The records go last, so the attribute can be cut down to what
+         * the drain returned; n is a multiple of 8.
+         */
+        hdr = genlmsg_put(skb, 0, 0, &intercept_genl_family, 0, INTERCEPT_CMD_PATHS);
+        if (!hdr || nla_put_u64_64bit(skb, INTERCEPT_ATTR_SEQ, nl_seq + 1, INTERCEPT_ATTR_PAD))
+            paths = NULL;
+        else
+            paths = nla_reserve(skb, INTERCEPT_ATTR_PATHS, round_down(netlink_batch - nl_trailer_room(), 8));
+        n = paths ? intercept_intern_drain(nla_data(paths), nla_len(paths)) : 0;
+        if (!n) {
+            kfree_skb(skb);
+            return;
+        }
+
+        skb_trim(skb, skb->len - (nla_len(paths) - n));
+        paths->nla_len = nla_attr_size(n);
+        nl_seq++;
+        genlmsg_end(skb, hdr);
+
+        ret = genlmsg_multicast(&intercept_genl_family, skb, 0, 0, GFP_KERNEL);
+        if (ret && ret != -ESRCH)
+            WRITE_ONCE(nl_overruns, nl_overruns + 1);
+    }
+}
+
+static void nl_flush(struct work_struct *work)
+{
+    struct sk_buff *fresh;
+    struct nlattr *fresh_events;
+    void *fresh_hdr;
+    struct nl_batch *b;
+    bool idle;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        b = per_cpu_ptr(&nl_batches, cpu);
+
+        spin_lock(&b->lock);
+        idle = b->skb && !b->nr;
+        spin_unlock(&b->lock);
+        if (idle)
+            continue;
+
+        fresh = nl_batch_alloc(&fresh_hdr, &fresh_events);
+
+        spin_lock(&b->lock);
+        b->out = b->skb;
+        b->out_hdr = b->hdr;
+        b->out_events = b->events;
+        b->out_nr = b->nr;
+        b->out_drops = b->drops;
+        b->skb = fresh;
+        b->hdr = fresh_hdr;
+        b->events = fresh_events;
+        b->nr = 0;
+        b->kicked = false;
+        spin_unlock(&b->lock);
+    }
+
+    /* An event that uses an id was recorded after its ADD record was queued,
+     * so with every batch swapped out the dictionary has them all.
+     */
+    if (static_key_enabled(&intercept_intern))
+        nl_send_paths();
+
+    for_each_possible_cpu(cpu) {
+        b = per_cpu_ptr(&nl_batches, cpu);
+
+        if (b->out && b->out_nr)
+            nl_send(b->out, b->out_hdr, b->out_events, cpu, b->out_nr, b->out_drops);
+        else
+            kfree_skb(b->out);
+        b->out = NULL;
+    }
+}
+
+static int netlink_show(struct seq_file *m, void *v)
+{
+    u64 drops = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        drops += READ_ONCE(per_cpu_ptr(&nl_batches, cpu)->drops);
+
+    seq_printf(m, "listeners %d batches %llu overruns %llu drops %llu\n",
+               genl_has_listeners(&intercept_genl_family, &init_net, 0),
+               READ_ONCE(nl_seq), READ_ONCE(nl_overruns), drops);
+    return 0;
+}
+
+int intercept_netlink_init(void)
+{
+    struct nl_batch *b;
+    int cpu, ret;
+
+    netlink_batch = clamp(netlink_batch, 4096U, 65000U);
+
+    ret = genl_register_family(&intercept_genl_family);
+    if (ret) {
+        pr_alert("Error: Could not register the %s generic netlink family\n", INTERCEPT_GENL_NAME);
+        return ret;
+    }
+
+    for_each_possible_cpu(cpu) {
+        b = per_cpu_ptr(&nl_batches, cpu);
+        spin_lock_init(&b->lock);
+        /* A failed allocation only drops the events, the flush tries again */
+        b->skb = nl_batch_alloc(&b->hdr, &b->events);
+    }
+
+    netlink_proc_file = proc_create_single("netlink", 0444, intercept_proc_dir, netlink_show);
+    if (!netlink_proc_file) {
+        pr_alert("Error: Could not initialize /proc/intercept/netlink\n");
+        intercept_netlink_exit();
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+/* Called once the hook is gone, so nothing adds to the batches any more.
+ * What is still in them is not sent.
+ */
+void intercept_netlink_exit(void)
+{
+    int cpu;
+
+    proc_remove(netlink_proc_file);
+    cancel_delayed_work_sync(&nl_flush_work);
+    for_each_possible_cpu(cpu)
+        kfree_skb(per_cpu_ptr(&nl_batches, cpu)->skb);
+    genl_unregister_family(&intercept_genl_family);
+}
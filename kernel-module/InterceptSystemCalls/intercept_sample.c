@@ -0,0 +1,166 @@
+/*
+* intercept_sample.c Sampling and rate limiting of the reported calls.
+*
+* On a host doing millions of opens per second even a cheap event is too
+* much. sample_rate=N keeps every Nth call of each CPU that passes the uid or
+* task filter and skips the rest before the hook copies a path or records
+* anything; the per-syscall counters then count the kept calls only, so
+* scale them by N. rate_limit=R on top of that keeps at most R calls per
+* second on each CPU, with bursts of up to rate_burst calls, as a token
+* bucket per CPU (kept as the time the bucket is full again, GCRA style, so
+* it is one u64 and no division in the hook).
+*
+* All three are module parameters that can be changed at any time:
+*     echo 100 > /sys/module/intercept/parameters/sample_rate
+*     echo 5000 > /sys/module/intercept/parameters/rate_limit
+* While sample_rate is 1 and rate_limit 0 the intercept_sampling static key
+* is off and the hook does not even look. /proc/intercept/sampling shows per
+* CPU how many calls were kept, sampled out and rate limited.
+*/
+
+#include <linux/jump_label.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+
+#include "intercept.h"
+
+DEFINE_STATIC_KEY_FALSE(intercept_sampling);
+
+static unsigned int sample_rate = 1;
+static unsigned int rate_limit;
+static unsigned int rate_burst = 100;
+
+/* Derived from rate_limit and rate_burst whenever one of them changes */
+static u64 rate_interval_ns;  // time one token takes to come back
+static u64 rate_tolerance_ns; // how far ahead of now the bucket may run
+
+struct sample_pcpu {
+    unsigned int countdown; // calls until the next kept one
+    u64 tat;                // when the bucket is full again
+    u64 kept;
+    u64 sampled_out;
+    u64 rate_limited;
+};
+
+static DEFINE_PER_CPU(struct sample_pcpu, sample_state);
+
+static struct proc_dir_entry *sampling_proc_file;
+
+static void sample_update(void)
+{
+    unsigned int limit = READ_ONCE(rate_limit);
+
+    if (limit) {
+        WRITE_ONCE(rate_interval_ns, div_u64(NSEC_PER_SEC, limit) ?: 1);
+        WRITE_ONCE(rate_tolerance_ns, rate_interval_ns * (max(READ_ONCE(rate_burst), 1U) - 1));
+    }
+
+    if (READ_ONCE(sample_rate) > 1 || limit)
+        static_branch_enable(&intercept_sampling);
+    else
+        static_branch_disable(&intercept_sampling);
+}
+
+/* The parameters are set under the module's parameter lock, so two updates
+ * never run at once.
+ */
+static int sample_param_set(const char *val, const struct kernel_param *kp)
+{
+    int ret;
+
+    ret = param_set_uint(val, kp);
+    if (ret)
+        return ret;
+
+    sample_update();
+    return 0;
+}
+
+static const struct kernel_param_ops sample_param_ops = {
+    .set = sample_param_set,
+    .get = param_get_uint,
+};
+module_param_cb(sample_rate, &sample_param_ops, &sample_rate, 0644);
+MODULE_PARM_DESC(sample_rate, "Report 1 in N of the calls that pass the filter, per CPU (default 1, all)");
+module_param_cb(rate_limit, &sample_param_ops, &rate_limit, 0644);
+MODULE_PARM_DESC(rate_limit, "Report at most N calls per second per CPU, 0 for no limit (default 0)");
+module_param_cb(rate_burst, &sample_param_ops, &rate_burst, 0644);
+MODULE_PARM_DESC(rate_burst, "Calls rate_limit lets through at once after a quiet spell (default 100)");
+
+/* Called by the hook for every call that passed the uid or task filter,
+ * whether to report it. A parameter changed meanwhile may be seen half
+ * updated for a call or two, which only shifts one sample.
+ */
+bool intercept_sample(void)
+{
+    struct sample_pcpu *s = get_cpu_ptr(&sample_state);
+    unsigned int rate = READ_ONCE(sample_rate);
+    bool keep = false;
+    u64 now, tat;
+
+    if (rate > 1) {
+        if (!s->countdown || s->countdown > rate)
+            s->countdown = rate;
+        if (--s->countdown) {
+            s->sampled_out++;
+            goto out;
+        }
+    }
+
+    if (READ_ONCE(rate_limit)) {
+        now = ktime_get_ns();
+        tat = max(s->tat, now);
+        if (tat - now > READ_ONCE(rate_tolerance_ns)) {
+            s->rate_limited++;
+            goto out;
+        }
+        s->tat = tat + READ_ONCE(rate_interval_ns);
+    }
+
+    s->kept++;
+    keep = true;
+out:
+    put_cpu_ptr(&sample_state);
+    return keep;
+}
+
+static int sampling_show(struct seq_file *m, void *v)
+{
+    u64 kept = 0, sampled_out = 0, rate_limited = 0;
+    struct sample_pcpu *s;
+    int cpu;
+
+    seq_printf(m, "sample_rate %u rate_limit %u rate_burst %u\n",
+               READ_ONCE(sample_rate), READ_ONCE(rate_limit), READ_ONCE(rate_burst));
+    seq_puts(m, "cpu\tkept\tsampled_out\trate_limited\n");
+    for_each_possible_cpu(cpu) {
+        s = per_cpu_ptr(&sample_state, cpu);
+        seq_printf(m, "%d\t%llu\t%llu\t%llu\n", cpu, s->kept, s->sampled_out, s->rate_limited);
+        kept += s->kept;
+        sampled_out += s->sampled_out;
+        rate_limited += s->rate_limited;
+    }
+    seq_printf(m, "all\t%llu\t%llu\t%llu\n", kept, sampled_out, rate_limited);
+    return 0;
+}
+
+int intercept_sample_init(void)
+{
+    sampling_proc_file = proc_create_single("sampling", 0444, intercept_proc_dir, sampling_show);
+    if (!sampling_proc_file) {
+        pr_alert("Error: Could not initialize /proc/intercept/sampling\n");
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void intercept_sample_exit(void)
+{
+    proc_remove(sampling_proc_file);
+}
@@ -0,0 +1,419 @@
+/*
+* intercept_subscribe.c Userspace subscriber of the intercept netlink events.
+*
+*     make subscribe
+*     sudo insmod intercept.ko uid=$(id -u) netlink=1
+*     sudo ./intercept_subscribe        # one line per event
+*     sudo ./intercept_subscribe -q     # only the totals, every second
+*
+* Looks up the "intercept" generic netlink family, joins its "events"
+* multicast group and decodes the batches described in intercept_uapi.h.
+* Any number of subscribers can run at once. Lost batches show up as gaps
+* in the batch numbers and as ENOBUFS from recv, the events the module could
+* not even batch as drops. -b sets the receive buffer, a bigger one rides out
+* longer stalls of the subscriber.
+*
+* With intern_paths=1 the events name known paths by id; the subscriber keeps
+* the dictionary the INTERCEPT_CMD_PATHS messages build up and prints the
+* paths as usual. Ids it never got a record for (it started late, or lost the
+* message) are counted as unknown, /proc/intercept/paths still has them.
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+
+#include "intercept_uapi.h"
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+#define BUF_SIZE (128 * 1024)
+
+#define GENL_DATA(nlh) ((char *)NLMSG_DATA(nlh) + GENL_HDRLEN)
+#define NLA_DATA(nla) ((char *)(nla) + NLA_HDRLEN)
+
+static volatile sig_atomic_t stop;
+
+struct totals {
+    uint64_t batches;
+    uint64_t events;
+    uint64_t bytes;
+    uint64_t gaps;      /* batches that never arrived */
+    uint64_t enobufs;   /* times our receive buffer overran */
+    uint64_t drops;     /* events the module lost, summed over the CPUs */
+    uint64_t overruns;  /* batches some subscriber lost, as the module counts them */
+    uint64_t interned;  /* events that named their path by id */
+    uint64_t unknown;   /* ids not in our dictionary */
+};
+
+/* The path dictionary, indexed by id. A deleted id may still show up in the
+ * events that were already batched, so it is only dropped when the next
+ * dictionary message comes in.
+ */
+static char **dict;
+static uint32_t dict_cap;
+static uint32_t *dict_dead;
+static uint32_t dict_nr_dead, dict_cap_dead;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/* Fills tb[type] with the attributes in [buf, buf + len) */
+static void parse_attrs(struct nlattr **tb, int max, char *buf, int len)
+{
+    struct nlattr *nla;
+
+    memset(tb, 0, sizeof(*tb) * (max + 1));
+    for (nla = (struct nlattr *)buf; len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len;
+         len -= NLA_ALIGN(nla->nla_len), nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len))) {
+        int type = nla->nla_type & NLA_TYPE_MASK;
+
+        if (type <= max)
+            tb[type] = nla;
+    }
+}
+
+static uint32_t nla_u32(const struct nlattr *nla)
+{
+    uint32_t v;
+
+    memcpy(&v, NLA_DATA(nla), sizeof(v));
+    return v;
+}
+
+static uint64_t nla_u64(const struct nlattr *nla)
+{
+    uint64_t v;
+
+    memcpy(&v, NLA_DATA(nla), sizeof(v));
+    return v;
+}
+
+static void put_attr(struct nlmsghdr *nlh, int type, const void *data, int len)
+{
+    struct nlattr *nla = (struct nlattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy(NLA_DATA(nla), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+/* Asks the generic netlink controller for the family id and the id of its
+ * events group.
+ */
+static int resolve_family(int fd, uint16_t *family, uint32_t *group)
+{
+    static char buf[BUF_SIZE];
+    struct nlattr *tb[CTRL_ATTR_MAX + 1], *grp[CTRL_ATTR_MCAST_GRP_MAX + 1], *nla;
+    struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+    struct genlmsghdr *genl;
+    int len, rem;
+
+    memset(buf, 0, NLMSG_SPACE(GENL_HDRLEN));
+    nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    nlh->nlmsg_type = GENL_ID_CTRL;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    genl = NLMSG_DATA(nlh);
+    genl->cmd = CTRL_CMD_GETFAMILY;
+    genl->version = 1;
+    put_attr(nlh, CTRL_ATTR_FAMILY_NAME, INTERCEPT_GENL_NAME, sizeof(INTERCEPT_GENL_NAME));
+
+    if (send(fd, buf, nlh->nlmsg_len, 0) < 0)
+        return -errno;
+    len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0)
+        return -errno;
+    if (!NLMSG_OK(nlh, len))
+        return -EPROTO;
+    if (nlh->nlmsg_type == NLMSG_ERROR)
+        return ((struct nlmsgerr *)NLMSG_DATA(nlh))->error ?: -EPROTO;
+
+    parse_attrs(tb, CTRL_ATTR_MAX, GENL_DATA(nlh), nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+    if (!tb[CTRL_ATTR_FAMILY_ID] || !tb[CTRL_ATTR_MCAST_GROUPS])
+        return -EPROTO;
+    memcpy(family, NLA_DATA(tb[CTRL_ATTR_FAMILY_ID]), sizeof(*family));
+
+    /* A nest of nests, one per group */
+    nla = (struct nlattr *)NLA_DATA(tb[CTRL_ATTR_MCAST_GROUPS]);
+    rem = tb[CTRL_ATTR_MCAST_GROUPS]->nla_len - NLA_HDRLEN;
+    for (; rem >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= rem;
+         rem -= NLA_ALIGN(nla->nla_len), nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len))) {
+        parse_attrs(grp, CTRL_ATTR_MCAST_GRP_MAX, NLA_DATA(nla), nla->nla_len - NLA_HDRLEN);
+        if (grp[CTRL_ATTR_MCAST_GRP_NAME] && grp[CTRL_ATTR_MCAST_GRP_ID] &&
+            !strcmp(NLA_DATA(grp[CTRL_ATTR_MCAST_GRP_NAME]), INTERCEPT_GENL_MCGRP)) {
+            *group = nla_u32(grp[CTRL_ATTR_MCAST_GRP_ID]);
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+static int dict_add(uint32_t id, const char *path)
+{
+    char **grown;
+    uint32_t cap;
+
+    if (id >= dict_cap) {
+        cap = dict_cap ? dict_cap : 1024;
+        while (cap <= id)
+            cap *= 2;
+        grown = realloc(dict, cap * sizeof(*dict));
+        if (!grown)
+            return -1;
+        memset(grown + dict_cap, 0, (cap - dict_cap) * sizeof(*dict));
+        dict = grown;
+        dict_cap = cap;
+    }
+    free(dict[id]);
+    dict[id] = strdup(path);
+    return dict[id] ? 0 : -1;
+}
+
+static void dict_del(uint32_t id)
+{
+    uint32_t *grown;
+
+    if (dict_nr_dead == dict_cap_dead) {
+        grown = realloc(dict_dead, (dict_cap_dead ? dict_cap_dead * 2 : 64) * sizeof(*dict_dead));
+        if (!grown)
+            return;
+        dict_dead = grown;
+        dict_cap_dead = dict_cap_dead ? dict_cap_dead * 2 : 64;
+    }
+    dict_dead[dict_nr_dead++] = id;
+}
+
+static void dict_reap(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < dict_nr_dead; i++) {
+        if (dict_dead[i] < dict_cap) {
+            free(dict[dict_dead[i]]);
+            dict[dict_dead[i]] = NULL;
+        }
+    }
+    dict_nr_dead = 0;
+}
+
+static const char *dict_get(uint32_t id)
+{
+    return id < dict_cap ? dict[id] : NULL;
+}
+
+/* Counts the messages that never arrived, events and dictionary alike */
+static void count_seq(struct nlattr *seq_attr, struct totals *t, uint64_t *last_seq)
+{
+    uint64_t seq = nla_u64(seq_attr);
+
+    if (*last_seq && seq > *last_seq + 1)
+        t->gaps += seq - *last_seq - 1;
+    *last_seq = seq;
+}
+
+static void handle_paths(struct nlmsghdr *nlh, struct totals *t, uint64_t *last_seq)
+{
+    struct nlattr *tb[INTERCEPT_ATTR_MAX + 1];
+    struct intercept_path_record rec;
+    char *p, *end;
+
+    parse_attrs(tb, INTERCEPT_ATTR_MAX, GENL_DATA(nlh), nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+    if (!tb[INTERCEPT_ATTR_SEQ] || !tb[INTERCEPT_ATTR_PATHS])
+        return;
+    count_seq(tb[INTERCEPT_ATTR_SEQ], t, last_seq);
+    dict_reap();
+
+    p = NLA_DATA(tb[INTERCEPT_ATTR_PATHS]);
+    end = (char *)tb[INTERCEPT_ATTR_PATHS] + tb[INTERCEPT_ATTR_PATHS]->nla_len;
+    while (end - p >= (long)sizeof(rec)) {
+        memcpy(&rec, p, sizeof(rec));
+        if (INTERCEPT_PATH_RECORD_LEN(rec.path_len) > (size_t)(end - p) ||
+            p[sizeof(rec) + rec.path_len] != '\0')
+            break;
+        if (rec.kind == INTERCEPT_PATH_ADD)
+            dict_add(rec.id, p + sizeof(rec));
+        else if (rec.kind == INTERCEPT_PATH_DEL)
+            dict_del(rec.id);
+        p += INTERCEPT_PATH_RECORD_LEN(rec.path_len);
+    }
+}
+
+static void print_event(const struct intercept_event *ev, uint32_t cpu, const char *path)
+{
+    printf("%llu cpu=%u pid=%u tid=%u uid=%u syscall=%u fd=%d count=%llu flags=0x%x mode=0%o %s%s%s\n",
+           (unsigned long long)ev->ts_ns, cpu, ev->pid, ev->tid, ev->uid, ev->syscall, ev->fd,
+           (unsigned long long)ev->count, ev->flags, ev->mode, path,
+           ev->event_flags & INTERCEPT_EVENT_TRUNCATED ? " [truncated]" : "",
+           ev->event_flags & INTERCEPT_EVENT_FAULT ? " [fault]" : "");
+}
+
+/* One batch: the events, then what the counters say about what was lost */
+static void handle_batch(struct nlmsghdr *nlh, struct totals *t, uint64_t *last_seq,
+                         uint64_t *cpu_drops, uint32_t nr_cpus, int quiet)
+{
+    struct nlattr *tb[INTERCEPT_ATTR_MAX + 1];
+    struct intercept_event ev;
+    uint32_t cpu, nr, i;
+    const char *path;
+    char unknown[24];
+    uint64_t drops;
+    char *rec, *end;
+    size_t len;
+
+    parse_attrs(tb, INTERCEPT_ATTR_MAX, GENL_DATA(nlh), nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+    if (!tb[INTERCEPT_ATTR_CPU] || !tb[INTERCEPT_ATTR_NR] || !tb[INTERCEPT_ATTR_SEQ] ||
+        !tb[INTERCEPT_ATTR_DROPS] || !tb[INTERCEPT_ATTR_OVERRUNS] || !tb[INTERCEPT_ATTR_EVENTS])
+        return;
+
+    cpu = nla_u32(tb[INTERCEPT_ATTR_CPU]);
+    nr = nla_u32(tb[INTERCEPT_ATTR_NR]);
+    drops = nla_u64(tb[INTERCEPT_ATTR_DROPS]);
+
+    t->batches++;
+    count_seq(tb[INTERCEPT_ATTR_SEQ], t, last_seq);
+    if (cpu < nr_cpus && drops > cpu_drops[cpu]) {
+        t->drops += drops - cpu_drops[cpu];
+        cpu_drops[cpu] = drops;
+    }
+    t->overruns = nla_u64(tb[INTERCEPT_ATTR_OVERRUNS]);
+
+    rec = NLA_DATA(tb[INTERCEPT_ATTR_EVENTS]);
+    end = (char *)tb[INTERCEPT_ATTR_EVENTS] + tb[INTERCEPT_ATTR_EVENTS]->nla_len;
+    for (i = 0; i < nr && end - rec >= (long)INTERCEPT_EVENT_RECORD_LEN(0); i++) {
+        /* The records are only as long as their path, copy what is there */
+        len = end - rec < (long)sizeof(ev) ? (size_t)(end - rec) : sizeof(ev);
+        memset(&ev, 0, sizeof(ev));
+        memcpy(&ev, rec, len);
+        if (ev.path_len >= INTERCEPT_PATH_MAX || INTERCEPT_EVENT_RECORD_LEN(ev.path_len) > (size_t)(end - rec))
+            break;
+        path = ev.path;
+        if (ev.event_flags & INTERCEPT_EVENT_INTERNED) {
+            t->interned++;
+            path = dict_get(ev.path_id);
+            if (!path) {
+                t->unknown++;
+                snprintf(unknown, sizeof(unknown), "#%u", ev.path_id);
+                path = unknown;
+            }
+        }
+        if (!quiet)
+            print_event(&ev, cpu, path);
+        rec += INTERCEPT_EVENT_RECORD_LEN(ev.path_len);
+        t->events++;
+    }
+}
+
+static void print_totals(const struct totals *t)
+{
+    fprintf(stderr, "batches %llu events %llu bytes %llu gaps %llu enobufs %llu drops %llu overruns %llu "
+            "interned %llu unknown %llu\n",
+            (unsigned long long)t->batches, (unsigned long long)t->events, (unsigned long long)t->bytes,
+            (unsigned long long)t->gaps, (unsigned long long)t->enobufs, (unsigned long long)t->drops,
+            (unsigned long long)t->overruns, (unsigned long long)t->interned, (unsigned long long)t->unknown);
+}
+
+int main(int argc, char **argv)
+{
+    static char buf[BUF_SIZE];
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+    struct totals t = { 0 };
+    uint64_t last_seq = 0, *cpu_drops;
+    uint32_t group = 0, nr_cpus;
+    uint16_t family = 0;
+    int fd, opt, len, ret, quiet = 0, rcvbuf = 0;
+    time_t last_print = 0;
+    struct nlmsghdr *nlh;
+
+    while ((opt = getopt(argc, argv, "qb:")) != -1) {
+        switch (opt) {
+        case 'q':
+            quiet = 1;
+            break;
+        case 'b':
+            rcvbuf = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-q] [-b rcvbuf_bytes]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    cpu_drops = calloc(nr_cpus, sizeof(*cpu_drops));
+    if (!cpu_drops)
+        return 1;
+
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("netlink socket");
+        return 1;
+    }
+
+    ret = resolve_family(fd, &family, &group);
+    if (ret) {
+        fprintf(stderr, "no %s netlink family (is the module loaded?): %s\n", INTERCEPT_GENL_NAME, strerror(-ret));
+        return 1;
+    }
+
+    /* SO_RCVBUFFORCE goes past rmem_max, as root */
+    if (rcvbuf && setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+        perror("SO_RCVBUF");
+
+    if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+        perror("NETLINK_ADD_MEMBERSHIP");
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while (!stop) {
+        len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == ENOBUFS) {
+                /* Our receive buffer overran, some batches are gone */
+                t.enobufs++;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            perror("recv");
+            break;
+        }
+        t.bytes += len;
+
+        for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != family)
+                continue;
+            if (((struct genlmsghdr *)NLMSG_DATA(nlh))->cmd == INTERCEPT_CMD_EVENTS)
+                handle_batch(nlh, &t, &last_seq, cpu_drops, nr_cpus, quiet);
+            else if (((struct genlmsghdr *)NLMSG_DATA(nlh))->cmd == INTERCEPT_CMD_PATHS)
+                handle_paths(nlh, &t, &last_seq);
+        }
+
+        if (quiet && time(NULL) != last_print) {
+            last_print = time(NULL);
+            print_totals(&t);
+        }
+    }
+
+    print_totals(&t);
+    close(fd);
+    free(cpu_drops);
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+* intercept_trace.h Tracepoint for the opens the hooks report:
+*     echo 1 > /sys/kernel/tracing/events/intercept/enable
+*     cat /sys/kernel/tracing/trace_pipe
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM intercept
+
+#if !defined(_INTERCEPT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _INTERCEPT_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/* filename is already copied into the kernel, the tracepoint never touches
+ * user memory.
+ */
+TRACE_EVENT(intercept_openat,
+
+    TP_PROTO(uid_t uid, const char *filename),
+
+    TP_ARGS(uid, filename),
+
+    TP_STRUCT__entry(
+        __field(uid_t, uid)
+        __string(filename, filename)
+    ),
+
+    TP_fast_assign(
+        __entry->uid = uid;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+        __assign_str(filename);
+#else
+        __assign_str(filename, filename);
+#endif
+    ),
+
+    TP_printk("uid=%u filename=%s", __entry->uid, __get_str(filename))
+);
+
+#endif /* _INTERCEPT_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE intercept_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,141 @@
+/*
+* intercept_uapi.h Userspace ABI of /dev/intercept: the binary event records
+* and the layout of the per-CPU rings exposed through mmap.
+* This header is shared between the module and userspace, so it only uses the
+* fixed size __u16/__u32/__u64 types from <linux/types.h>, and every struct has
+* the same layout for 32 and 64 bit callers (no pointers or longs, explicit padding).
+*
+* Every possible CPU has its own ring of INTERCEPT_EVENT_SIZE byte slots, which
+* only that CPU writes to. Each ring is ring_size bytes long (the same for all
+* CPUs, read it from the control page of CPU 0):
+*     mmap(fd, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, cpu * ring_size)
+* maps the control page (struct intercept_ring_ctrl) of that CPU followed by the
+* slots. head and tail are free running event counts, event e lives in slot
+* e & (nr_slots - 1), at data_offset + slot * INTERCEPT_EVENT_SIZE.
+*
+* Consumer protocol, per CPU (the same as the mychardev ring):
+*   1. h = load_acquire(&ctrl->head)
+*   2. consume the events in [ctrl->tail, h) straight out of the slots
+*   3. store_release(&ctrl->tail, h)
+*   4. when every ring is empty: store need_wakeup = 1 on each of them, full
+*      barrier, re-check the heads, and only if they are still empty block in
+*      poll(fd, POLLIN).
+* There must be a single consumer: either mmap and the protocol above, or
+* read(), which does the same thing for every CPU and returns whole events.
+* Events of different CPUs are not ordered, sort on ts_ns if that matters.
+*
+* With netlink=1 the events go to the "events" multicast group of the
+* INTERCEPT_GENL_NAME generic netlink family instead, so any number of
+* subscribers can get them. Every message (INTERCEPT_CMD_EVENTS) is a batch of
+* the events of one CPU: INTERCEPT_ATTR_EVENTS holds INTERCEPT_ATTR_NR records,
+* each a struct intercept_event cut after the NUL of its path and padded to
+* INTERCEPT_EVENT_RECORD_LEN(path_len) bytes. A subscriber that misses a
+* batch sees a gap in INTERCEPT_ATTR_SEQ (and ENOBUFS from recv if its own
+* receive buffer overran); INTERCEPT_ATTR_DROPS counts the events its CPU lost
+* before they even made it into a batch.
+*/
+
+#ifndef INTERCEPT_UAPI_H
+#define INTERCEPT_UAPI_H
+
+#include <linux/types.h>
+
+#define INTERCEPT_RING_VERSION 3 /* 2: every hooked syscall, 3: path_id */
+
+#define INTERCEPT_EVENT_SIZE 256
+#define INTERCEPT_PATH_MAX (INTERCEPT_EVENT_SIZE - 56)
+
+/* Flags for intercept_event.event_flags */
+#define INTERCEPT_EVENT_TRUNCATED (1U << 0) /* path was longer than INTERCEPT_PATH_MAX - 1 bytes */
+#define INTERCEPT_EVENT_FAULT     (1U << 1) /* the path could not be read from the caller, path is empty */
+#define INTERCEPT_EVENT_INTERNED  (1U << 2) /* path is empty, path_id says which it was */
+
+/* One intercepted call, recorded when it enters the hook. Fields the syscall
+ * does not have are 0, or -1 for fd: a read has no path, an execve no fd.
+ */
+struct intercept_event {
+    __u64 ts_ns;        /* ktime_get_ns() when the call entered the hook */
+    __u32 pid;          /* thread group id of the caller */
+    __u32 tid;          /* thread id of the caller */
+    __u32 uid;          /* real uid of the caller */
+    __s32 flags;        /* open flags passed to open or openat */
+    __u16 mode;         /* mode passed to open or openat */
+    __u16 path_len;     /* bytes in path, without the terminating NUL */
+    __u32 event_flags;  /* INTERCEPT_EVENT_* */
+    __u16 syscall;      /* system call number (__NR_*) of the native ABI */
+    __u16 reserved;     /* 0 */
+    __s32 fd;           /* file descriptor argument of read, write, close, ... */
+    __u64 count;        /* byte count asked for by read and write */
+    __u32 path_id;      /* with INTERCEPT_EVENT_INTERNED, see struct intercept_path_record */
+    __u32 reserved2;    /* 0 */
+    char path[INTERCEPT_PATH_MAX]; /* NUL terminated */
+};
+
+/* With intern_paths=1 the events carry a path the module has seen before as
+ * path_id instead of the path itself. The ids count up from 1 and are never
+ * handed out twice. Before the first event with a new id, the module queues
+ * an INTERCEPT_PATH_ADD record for it on the dictionary stream:
+ * /dev/intercept_paths, or INTERCEPT_CMD_PATHS messages with netlink=1. When
+ * the dictionary is full the least recently used path makes room, and an
+ * INTERCEPT_PATH_DEL record says its id is gone; events recorded just before
+ * may still carry it, so keep the path until those are read. A consumer that
+ * starts late can look up the paths still in the dictionary in
+ * /proc/intercept/paths.
+ */
+#define INTERCEPT_PATH_ADD 1
+#define INTERCEPT_PATH_DEL 2
+
+struct intercept_path_record {
+    __u32 id;
+    __u16 kind;         /* INTERCEPT_PATH_* */
+    __u16 path_len;     /* bytes in path without the NUL, 0 for INTERCEPT_PATH_DEL */
+    char path[];        /* NUL terminated, the record is INTERCEPT_PATH_RECORD_LEN(path_len) long */
+};
+
+#define INTERCEPT_PATH_RECORD_LEN(path_len) ((sizeof(struct intercept_path_record) + (path_len) + 1 + 7) & ~7U)
+
+struct intercept_ring_ctrl {
+    __u32 version;      /* INTERCEPT_RING_VERSION */
+    __u32 data_offset;  /* offset of the first slot from the start of the ring */
+    __u32 nr_slots;     /* number of slots, always a power of two */
+    __u32 need_wakeup;  /* set by an idle consumer, cleared by the producer when it wakes it */
+    __u64 ring_size;    /* bytes of one ring, the mmap offset of CPU n is n * ring_size */
+    __u64 drops;        /* events lost because the ring was full, written by the module only */
+
+    /* Producer and consumer positions live on their own cache lines, so the
+     * producer writing head does not bounce the line the consumer writes tail on.
+     */
+    __u64 head __attribute__((aligned(64)));  /* written by the module only */
+    __u64 tail __attribute__((aligned(64)));  /* written by the consumer */
+};
+
+#define INTERCEPT_GENL_NAME "intercept"
+#define INTERCEPT_GENL_VERSION 1
+#define INTERCEPT_GENL_MCGRP "events"
+
+#define INTERCEPT_EVENT_RECORD_LEN(path_len) \
+    ((__builtin_offsetof(struct intercept_event, path) + (path_len) + 1 + 7) & ~7U)
+
+enum {
+    INTERCEPT_CMD_UNSPEC,
+    INTERCEPT_CMD_EVENTS,       /* a batch of events, multicast by the module */
+    INTERCEPT_CMD_PATHS,        /* dictionary records, sent before the events that use them */
+    __INTERCEPT_CMD_MAX,
+};
+#define INTERCEPT_CMD_MAX (__INTERCEPT_CMD_MAX - 1)
+
+enum {
+    INTERCEPT_ATTR_UNSPEC,
+    INTERCEPT_ATTR_PAD,
+    INTERCEPT_ATTR_CPU,         /* __u32, the CPU all events of the batch ran on */
+    INTERCEPT_ATTR_SEQ,         /* __u64, batch number, one up for every batch sent */
+    INTERCEPT_ATTR_NR,          /* __u32, records in INTERCEPT_ATTR_EVENTS */
+    INTERCEPT_ATTR_DROPS,       /* __u64, events of this CPU lost so far because its batch was full */
+    INTERCEPT_ATTR_OVERRUNS,    /* __u64, batches so far that some subscriber had no room for */
+    INTERCEPT_ATTR_EVENTS,      /* the records, back to back */
+    INTERCEPT_ATTR_PATHS,       /* struct intercept_path_record records, back to back */
+    __INTERCEPT_ATTR_MAX,
+};
+#define INTERCEPT_ATTR_MAX (__INTERCEPT_ATTR_MAX - 1)
+
+#endif /* INTERCEPT_UAPI_H */
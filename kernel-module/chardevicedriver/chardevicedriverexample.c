@@ -1,6 +1,11 @@
 /*
-* chardevicedriverexample.c Creates a read only char device that says how many times
-* you have read from the dev file.
+* chardevicedriverexample.c Creates nr_queues char devices /dev/mychardev0..N-1
+* that say how many times you have read from the dev file, followed by
+* whatever writers pushed into that device's page backed ring buffer. The ring
+* can also be mmap'ed, so a consumer can drain data without any syscall or
+* copy (see mychardev_uapi.h for the layout). Every minor is an independent
+* queue with its own ring, write buffers and statistics, so traffic can be
+* sharded across cores and processes like the queues of a multi-queue NIC.
 * NOTE: kernel modules requires Tabs and not spaces in indentation.
 
 * Different filesystems like /proc /dev have different function pointers structs. Based on which filesystem one need to 
@@ -10,116 +15,547 @@
 */
 
 #include <linux/atomic.h>
+#include <linux/cdev.h>
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/jump_label.h>
 #include <linux/kernel.h> /*Needed for sprintf function*/
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/pagemap.h> /*Needed for fault_in_writeable*/
+#include <linux/percpu.h>
+#include <linux/preempt.h>
 #include <linux/printk.h>
+#include <linux/slab.h>
+#include <linux/splice.h>
 #include <linux/types.h> 
-#include <linux/uaccess.h> /*Needed for get_user and put_user*/
+#include <linux/uaccess.h> /*Needed for get_user, put_user and copy_to_user*/
+#include <linux/uio.h> /*Needed for iov_iter*/
+#include <linux/version.h>
+#include <linux/vmalloc.h> /*Needed for vmalloc_user to allocate the ring pages*/
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <asm/errno.h>
 
+#include "mychardev_uapi.h"
+
+#define CREATE_TRACE_POINTS
+#include "mychardev_trace.h"
+
 
 /*These will be moved to its own header file*/
 static int device_open(struct inode *,struct file *);
 static int device_release(struct inode *, struct file *);
-static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
-static ssize_t device_write(struct file *, const char __user *, size_t,loff_t *);
+static ssize_t device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t device_write_iter(struct kiocb *, struct iov_iter *);
+static int device_mmap(struct file *, struct vm_area_struct *);
+static __poll_t device_poll(struct file *, struct poll_table_struct *);
+static long device_ioctl(struct file *, unsigned int, unsigned long);
+static void ring_space_work(struct work_struct *);
 
 #define SUCCESS 0
 #define DEVICE_NAME "mychardev" //this name will show up in /proc/devices
-#define BUFFER_LEN 80 /* Max length of the message from the device */
+#define MAX_QUEUES 256
+#define BUFFER_LEN 80 /* Max length of the greeting message from the device */
 
 /* Global variables are declared as static, so are global within the file. */
 
-static int major; //major number which will be defined to the driver
+static dev_t first_devt; //major number and first minor which will be defined to the driver
+static struct cdev mychardev_cdev;
+
+/* Per call logging of reads and writes. Off by default: a pr_info per call
+ * floods the printk buffer and serializes writers on the console lock, so the
+ * check sits behind a static key that compiles to a nop until debug=1 is set
+ * (at load time or later through /sys/module/chardevicedriverexample/parameters/debug).
+ * The mychardev tracepoints are the cheap way to watch the traffic.
+ */
+static DEFINE_STATIC_KEY_FALSE(mychardev_debug);
+
+static int debug_param_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(val, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        static_branch_enable(&mychardev_debug);
+    else
+        static_branch_disable(&mychardev_debug);
+    return 0;
+}
+
+static int debug_param_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&mychardev_debug) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops debug_param_ops = {
+    .set = debug_param_set,
+    .get = debug_param_get,
+};
+module_param_cb(debug, &debug_param_ops, NULL, 0644);
+MODULE_PARM_DESC(debug, "Log every read and write with pr_info (default N)");
+
+/* Number of queues, i.e. minors /dev/mychardev0..nr_queues-1 */
+static unsigned int nr_queues = 1;
+module_param(nr_queues, uint, 0444);
+MODULE_PARM_DESC(nr_queues, "Number of independent queues/minors (default 1, 0 = one per online CPU)");
+
+/* Size of the ring data area, in pages (rounded up to a power of two). The
+ * ring is allocated with vmalloc_user, so it is built from whole (zeroed)
+ * pages that can be mapped into userspace with remap_vmalloc_range. The
+ * size has to fit the __u32 data_size of the control page, so it is at most
+ * 2 GiB.
+ */
+#define BUFFER_PAGES_MAX ((1U << 31) >> PAGE_SHIFT)
+
+static unsigned int buffer_pages = 16;
+module_param(buffer_pages, uint, 0444);
+MODULE_PARM_DESC(buffer_pages, "Size of the device ring buffer in pages (default 16)");
+
+/* Kept only to compare the old byte at a time put_user loop against the bulk
+ * copy of the ring read path, e.g.
+ * "echo 1 > /sys/module/chardevicedriverexample/parameters/bytewise_read"
+ */
+static bool bytewise_read;
+module_param(bytewise_read, bool, 0644);
+MODULE_PARM_DESC(bytewise_read, "Copy reads out of the ring one byte at a time (for comparison only)");
+
+/* Size of each CPU's write buffer, in pages. Writes up to this size land in
+ * the ring in one piece, never interleaved with other writers.
+ */
+static unsigned int pcpu_buffer_pages = 4;
+module_param(pcpu_buffer_pages, uint, 0444);
+MODULE_PARM_DESC(pcpu_buffer_pages, "Size of each per-CPU write buffer in pages (default 4, at most buffer_pages)");
+
+/* Largest piece of the ring one reader claims at a time. Claims are handed
+ * back in the order they were taken, so this bounds how long a later claim
+ * may have to wait for an earlier one to be copied out.
+ */
+#define RING_CLAIM_MAX (16 * PAGE_SIZE)
+
+/* Set in ring_reserve while the ring is mapped: no claims are taken then */
+#define RING_RESERVE_CLOSED (1ULL << 63)
+
+/* Descriptors of a batch are copied in and their results out this many at a time */
+#define BATCH_CHUNK 16
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 16, 0)
+/* Older kernels can not pre-fault an iov_iter for writing; the claim path
+ * then just relies on parking whatever did not fit in mf->pending.
+ */
+#define fault_in_iov_iter_writeable(i, size) 0
+#endif
+
+/* copy_splice_read replaced generic_file_splice_read in v6.5 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+#define device_splice_read copy_splice_read
+#else
+#define device_splice_read generic_file_splice_read
+#endif
+
+/* Producer side: writers never touch the ring directly. Each CPU has its own
+ * write buffer; a writer appends to the buffer of the CPU it runs on and only
+ * takes that buffer's mutex, which nobody on another CPU touches in the
+ * common case. Whole buffers are later merged into the ring (see
+ * pcpu_flush), either by the writer when its buffer fills up or a consumer is
+ * waiting, or by a reader that found the ring empty.
+ *
+ * Ordering is relaxed: bytes from one CPU come out in the order they were
+ * written, and a write() of up to pcpu_size bytes is never split, but writes
+ * on different CPUs appear in the order their buffers happened to be merged,
+ * not in timestamp order.
+ *
+ * The buffer mutex (not preempt_disable) makes this preempt safe: a writer
+ * that migrates after picking its buffer keeps using that buffer, and may
+ * copy_from_iter (and fault) while holding it.
+ */
+struct mychardev_pcpu_buf {
+    struct mutex lock;
+    char *data;     /* pcpu_size bytes */
+    size_t len;
+};
+
+/* Per queue counters, one copy per CPU so counting never bounces a cache
+ * line between writers. Summed up when /sys/class/mychardev/mychardevN/stats
+ * is read.
+ */
+struct mychardev_stats {
+    u64 writes;
+    u64 bytes_written;
+    u64 reads;
+    u64 bytes_read;
+    u64 merges;
+    u64 wakeups;
+};
+
+/* One independent queue per minor */
+struct mychardev_queue {
+    unsigned int index;
+    struct device *dev;
+
+    /* The ring: one control page followed by ring_size bytes of data pages,
+     * all in one vmalloc_user area so that mmap can hand out the whole thing
+     * at once.
+     */
+    void *ring_mem;
+    struct mychardev_ring_ctrl *ring_ctrl;
+    char *ring_data;
+
+    struct mychardev_pcpu_buf __percpu *pcpu_bufs;
+
+    /* Merging buffers into the ring is serialized by ring_lock. ring_head is
+     * the driver's own copy of the head, so a consumer scribbling over the
+     * shared control page can never make us write outside the ring.
+     */
+    struct mutex ring_lock;
+    u64 ring_head;
+
+    /* Consumer side, lock free: a reader claims up to RING_CLAIM_MAX bytes
+     * by moving ring_reserve past them with a cmpxchg, copies them out with
+     * no lock held, then hands them back by moving ring_tail past them.
+     * Claims are handed back in the order they were taken; a reader whose
+     * predecessor is still copying sleeps on commit_wait, and as the copies
+     * never sleep or fault that is short. ring_head, ring_reserve and
+     * ring_tail are kernel private, the control page only gets copies of
+     * them. While the ring is mmap'ed the mapping owns the consumer side and
+     * publishes its own ctrl->tail (see device_mmap), ring_reserve is closed
+     * and read() returns -EBUSY. map_lock serializes mmap and the last unmap.
+     */
+    atomic64_t ring_reserve ____cacheline_aligned_in_smp;
+    u64 ring_tail;
+    wait_queue_head_t commit_wait;
+    struct mutex map_lock;
+    atomic_t ring_mapped;
+
+    /* Readers sleeping in read() or poll() until the ring is not empty any more */
+    wait_queue_head_t ring_wait;
+
+    /* Writers sleeping in write() or poll() until the ring has space again.
+     * read() wakes them when it frees space; an mmap consumer does not enter
+     * the kernel for that, so while the ring is mapped and somebody waits,
+     * space_work looks at its tail once a tick instead.
+     */
+    wait_queue_head_t ring_space_wait;
+    struct delayed_work space_work;
 
-enum {
-    CDEV_NOT_USED = 0;
-    CDEV_EXCLUSIVE_OPEN = 1;
+    struct mychardev_stats __percpu *stats;
 };
 
-/* Check if device is open. Its used to prevent multiple access to device*/
-static atomic_t already_open = ATOMIC_INIT(CDEV_NOT_USED);
+static struct mychardev_queue *queues;
 
-static char msg[BUF_LEN + 1]; /* The msg the device will give when asked */
+/* Same sizes for every queue */
+static size_t ring_mem_len;
+static size_t ring_size; /* power of two */
+static size_t pcpu_size;
+
+/* Per open file state, hung off file->private_data. Any number of processes
+ * and threads can have a device open at the same time; each of them gets
+ * its own greeting and its own pending bytes.
+ */
+struct mychardev_file {
+    struct mychardev_queue *q; /* the queue behind the minor that was opened */
+
+    /* Bytes this reader owns but has not handed to userspace yet: first the
+     * greeting msg, later whatever part of a ring claim did not fit into the
+     * user buffer. Holds up to RING_CLAIM_MAX bytes.
+     */
+    char *pending;
+    size_t pending_len;
+    size_t pending_pos;
+};
+
+/* Counts the opens, used for the greeting */
+static atomic_t open_counter = ATOMIC_INIT(0);
 
 static struct class *cls;
 
-/*function pointers read,write,open,release in file_operations struct called
- *by kernel when a process tries to open the device file, like "sudo cat /dev/mychardev" 
- *pointing to mychardev driver functions device_read, device_write,device_open, device_release */
+/*function pointers read_iter,write_iter,open,release in file_operations struct called
+ *by kernel when a process tries to open the device file, like "sudo cat /dev/mychardev0" 
+ *pointing to mychardev driver functions device_read_iter, device_write_iter,device_open, device_release.
+ *read_iter/write_iter take an iov_iter, so read/readv/io_uring all go through the same
+ *code, and the generic splice helpers can move data to a pipe without a trip through userspace. */
 static struct file_operations mychardev_fops = {
-    .read = device_read,
-    .write = device_write,
+    .read_iter = device_read_iter,
+    .write_iter = device_write_iter,
+    .splice_read = device_splice_read,
+    .splice_write = iter_file_splice_write,
     .open = device_open,
     .release = device_release,
+    .mmap = device_mmap,
+    .poll = device_poll,
+    .unlocked_ioctl = device_ioctl,
+    /* The ioctl structs have the same layout for 32 bit callers, only the
+     * argument pointer needs converting.
+     */
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+static void mychardev_queue_free(struct mychardev_queue *q)
+{
+    int cpu;
+
+    cancel_delayed_work_sync(&q->space_work);
+    if (q->pcpu_bufs) {
+        for_each_possible_cpu(cpu)
+            kvfree(per_cpu_ptr(q->pcpu_bufs, cpu)->data);
+        free_percpu(q->pcpu_bufs);
+    }
+    free_percpu(q->stats);
+    vfree(q->ring_mem);
+}
+
+static int mychardev_queue_alloc(struct mychardev_queue *q, unsigned int index)
+{
+    struct mychardev_pcpu_buf *buf;
+    int cpu;
+
+    q->index = index;
+    mutex_init(&q->ring_lock);
+    atomic64_set(&q->ring_reserve, 0);
+    init_waitqueue_head(&q->commit_wait);
+    mutex_init(&q->map_lock);
+    atomic_set(&q->ring_mapped, 0);
+    init_waitqueue_head(&q->ring_wait);
+    init_waitqueue_head(&q->ring_space_wait);
+    INIT_DELAYED_WORK(&q->space_work, ring_space_work);
+
+    q->ring_mem = vmalloc_user(ring_mem_len);
+    q->pcpu_bufs = alloc_percpu(struct mychardev_pcpu_buf);
+    q->stats = alloc_percpu(struct mychardev_stats);
+    if (!q->ring_mem || !q->pcpu_bufs || !q->stats)
+        goto fail;
+
+    q->ring_ctrl = q->ring_mem;
+    q->ring_data = (char *)q->ring_mem + PAGE_SIZE;
+
+    q->ring_ctrl->version = MYCHARDEV_RING_VERSION;
+    q->ring_ctrl->data_offset = PAGE_SIZE;
+    q->ring_ctrl->data_size = ring_size;
+
+    for_each_possible_cpu(cpu) {
+        buf = per_cpu_ptr(q->pcpu_bufs, cpu);
+        mutex_init(&buf->lock);
+        /* Keep every CPU's buffer on that CPU's memory node */
+        buf->data = kvmalloc_node(pcpu_size, GFP_KERNEL, cpu_to_node(cpu));
+        if (!buf->data)
+            goto fail;
+    }
+
+    return SUCCESS;
+
+fail:
+    mychardev_queue_free(q);
+    return -ENOMEM;
+}
+
+/* /sys/class/mychardev/mychardevN/stats: the counters of one queue, summed
+ * over all CPUs.
+ */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct mychardev_queue *q = dev_get_drvdata(dev);
+    struct mychardev_stats sum = {};
+    struct mychardev_stats *st;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(q->stats, cpu);
+        sum.writes += READ_ONCE(st->writes);
+        sum.bytes_written += READ_ONCE(st->bytes_written);
+        sum.reads += READ_ONCE(st->reads);
+        sum.bytes_read += READ_ONCE(st->bytes_read);
+        sum.merges += READ_ONCE(st->merges);
+        sum.wakeups += READ_ONCE(st->wakeups);
+    }
+
+    return sysfs_emit(buf,
+                      "writes %llu\nbytes_written %llu\nreads %llu\nbytes_read %llu\n"
+                      "merges %llu\nwakeups %llu\nqueued %llu\n",
+                      sum.writes, sum.bytes_written, sum.reads, sum.bytes_read,
+                      sum.merges, sum.wakeups,
+                      READ_ONCE(q->ring_ctrl->head) - READ_ONCE(q->ring_ctrl->tail));
+}
+static DEVICE_ATTR_RO(stats);
+
+static struct attribute *mychardev_attrs[] = {
+    &dev_attr_stats.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(mychardev);
+
+static void mychardev_destroy_queues(unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        device_destroy(cls, MKDEV(MAJOR(first_devt), MINOR(first_devt) + i));
+        mychardev_queue_free(&queues[i]);
+    }
+    kfree(queues);
 }
 
 // module's init function starts
 static int __init mychardev_init(void)
 {
-    //registering the character device driver and asking kernel to dynamically generate major number(by passing 0 as first arg) for device driver
+    //registering the character device driver and asking kernel to dynamically allocate a major number and nr_queues minors for it
     /*
     Ref: Linux Kernel Module Programming Guide Sec 6.2 Registering a device
-    If you pass a major number of 0 to register_chrdev, the return value will
-    be the dynamically allocated major number. The downside is that you can not
-    make a device file in advance, since you do not know what the major number
-    will be. There are a couple of ways to do this. First, the driver itself can print
-    the newly assigned number and we can make the device file by hand. Second,
-    the newly registered device will have an entry in /proc/devices, and we can
-    either make the device file by hand or write a shell script to read the file in and
-    make the device file. The third method is that we can have our driver make the
-    device file using the device_create function after a successful registration and
-    device_destroy during the call to cleanup_module.
+    register_chrdev hands out a major number together with all 256 minors
+    behind it. alloc_chrdev_region together with a struct cdev is the newer
+    interface: it asks for exactly the minors we need (one per queue), and
+    cdev_add makes the kernel call our file_operations for all of them. Like
+    with register_chrdev(0, ...), the major number is allocated dynamically,
+    so we can not make the device files in advance; device_create makes the
+    /dev/mychardevN nodes for us (through udev) after a successful
+    registration, and device_destroy removes them during cleanup.
     */
-    major = register_chardev(0, DEVICE_NAME, &mychardev_fops);
+    struct device *dev;
+    unsigned int i;
+    int ret;
+
+    if (!buffer_pages || buffer_pages > BUFFER_PAGES_MAX) {
+        pr_alert("buffer_pages must be between 1 and %u\n", BUFFER_PAGES_MAX);
+        return -EINVAL;
+    }
+
+    if (!pcpu_buffer_pages) {
+        pr_alert("pcpu_buffer_pages must be at least 1\n");
+        return -EINVAL;
+    }
 
-    if (major < 0) {
-        pr_alert("Registering char device failed with %d\n", major);
-        return major;
+    if (!nr_queues)
+        nr_queues = num_online_cpus();
+    if (nr_queues > MAX_QUEUES) {
+        pr_alert("nr_queues must be at most %u\n", MAX_QUEUES);
+        return -EINVAL;
     }
 
-    pr_info("Character Device Driver assigned major number %d.\n", major);
+    ring_size = (size_t)roundup_pow_of_two(buffer_pages) << PAGE_SHIFT;
+    ring_mem_len = PAGE_SIZE + ring_size;
+    pcpu_size = (size_t)min(pcpu_buffer_pages, buffer_pages) << PAGE_SHIFT;
 
+    ret = alloc_chrdev_region(&first_devt, 0, nr_queues, DEVICE_NAME);
+    if (ret < 0) {
+        pr_alert("Registering char device failed with %d\n", ret);
+        return ret;
+    }
+
+    pr_info("Character Device Driver assigned major number %d.\n", MAJOR(first_devt));
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    cls = class_create(DEVICE_NAME);
+#else
     cls = class_create(THIS_MODULE, DEVICE_NAME);
-    device_create(cls, NULL, MKDEV(major, 0), NULL, DEVICE_NAME);
+#endif
+    if (IS_ERR(cls)) {
+        ret = PTR_ERR(cls);
+        goto fail_region;
+    }
 
-    pr_info("Device created on /dev/%s\n", DEVICE_NAME);
+    queues = kcalloc(nr_queues, sizeof(*queues), GFP_KERNEL);
+    if (!queues) {
+        ret = -ENOMEM;
+        goto fail_class;
+    }
+
+    for (i = 0; i < nr_queues; i++) {
+        ret = mychardev_queue_alloc(&queues[i], i);
+        if (ret) {
+            pr_alert("Could not allocate queue %u\n", i);
+            goto fail_queues;
+        }
+
+        dev = device_create_with_groups(cls, NULL, MKDEV(MAJOR(first_devt), MINOR(first_devt) + i),
+                                        &queues[i], mychardev_groups, DEVICE_NAME "%u", i);
+        if (IS_ERR(dev)) {
+            ret = PTR_ERR(dev);
+            mychardev_queue_free(&queues[i]);
+            goto fail_queues;
+        }
+        queues[i].dev = dev;
+    }
+
+    /* Only make the devices reachable once every queue is set up */
+    cdev_init(&mychardev_cdev, &mychardev_fops);
+    mychardev_cdev.owner = THIS_MODULE;
+    ret = cdev_add(&mychardev_cdev, first_devt, nr_queues);
+    if (ret)
+        goto fail_queues;
+
+    pr_info("Devices created on /dev/%s0..%u, each with a %zu byte ring\n",
+            DEVICE_NAME, nr_queues - 1, ring_size);
 
     return SUCCESS;
+
+fail_queues:
+    mychardev_destroy_queues(i);
+fail_class:
+    class_destroy(cls);
+fail_region:
+    unregister_chrdev_region(first_devt, nr_queues);
+    return ret;
 }
 
 // driver module cleanup function starts
 static void __exit mychardev_exit(void)
 {
-    device_destroy(cls, MKDEV(major, 0));
+    cdev_del(&mychardev_cdev);
+    mychardev_destroy_queues(nr_queues);
     class_destroy(cls);
 
-    /* Unregister the device */
-    unregister_chrdev(major, DEVICE_NAME);
+    /* Unregister the device numbers */
+    unregister_chrdev_region(first_devt, nr_queues);
 }
 
 /*Driver methods definition starts 
 static int device_open(struct inode *,struct file *);
 static int device_release(struct inode *, struct file *);
-static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
-static ssize_t device_write(struct file *, const char __user *, size_t,loff_t *);
+static ssize_t device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t device_write_iter(struct kiocb *, struct iov_iter *);
+static int device_mmap(struct file *, struct vm_area_struct *);
+static __poll_t device_poll(struct file *, struct poll_table_struct *);
+static long device_ioctl(struct file *, unsigned int, unsigned long);
 */
 
-/* Called when a process tries to open the device file, like "sudo cat /dev/mychardev"
+/* Called when a process tries to open the device file, like "sudo cat /dev/mychardev0"
 */
 
 static int device_open(struct inode *inode, struct file *file)
 {
-    static int counter = 0;
+    struct mychardev_file *mf;
 
-    if (atomic_cmpxchg(&already_open, CDEV_NOT_USED, CDEV_EXCLUSIVE_OPEN))
-        return -EBUSY;  
+    mf = kzalloc(sizeof(*mf), GFP_KERNEL);
+    if (!mf)
+        return -ENOMEM;
 
-    sprintf(msg, "I already told you %d times Hello world!\n", counter++);
+    /* The minor number tells which queue this node belongs to */
+    mf->q = &queues[iminor(inode) - MINOR(first_devt)];
+
+    if (file->f_mode & FMODE_READ) {
+        mf->pending = kvmalloc(RING_CLAIM_MAX, GFP_KERNEL);
+        if (!mf->pending) {
+            kfree(mf);
+            return -ENOMEM;
+        }
+        mf->pending_len = snprintf(mf->pending, BUFFER_LEN + 1,
+                                   "I already told you %d times Hello world!\n",
+                                   atomic_inc_return(&open_counter) - 1);
+    }
+
+    file->private_data = mf;
+
+    /* The ring is a stream, a position in it can not be seeked to */
+    stream_open(inode, file);
     try_module_get(THIS_MODULE);
 
     return SUCCESS; 
@@ -128,8 +564,11 @@ static int device_open(struct inode *inode, struct file *file)
 /* Called when a process closes the device file. */
 static int device_release(struct inode *inode, struct file *file)
 {
-    /* We're now ready for our next caller */
-    atomic_set(&already_open, CDEV_NOT_USED);
+    struct mychardev_file *mf = file->private_data;
+
+    /* Bytes still pending here were claimed from the ring and are lost */
+    kvfree(mf->pending);
+    kfree(mf);
 
     /* Decrement the usage count, or else once you opened the file, you will
      * never get rid of the module.
@@ -139,53 +578,839 @@ static int device_release(struct inode *inode, struct file *file)
     return SUCCESS;
 }
 
+/* The old read path: one byte per user access, so every byte pays for its
+ * own access check and fault handling, which is why it tops out at a few
+ * MB/s. Only used when bytewise_read is set.
+ */
+static size_t ring_copy_to_iter_bytewise(struct mychardev_queue *q, u64 pos, size_t len, struct iov_iter *to)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (!copy_to_iter(q->ring_data + ((pos + i) & (ring_size - 1)), 1, to))
+            break;
+    return i;
+}
+
+/* Copy up to len bytes starting at ring position pos into the iterator, in
+ * at most two copies (before and after the wrap point). Returns the number of
+ * bytes copied, which is short only if a user page could not be written.
+ */
+static size_t ring_copy_to_iter(struct mychardev_queue *q, u64 pos, size_t len, struct iov_iter *to)
+{
+    size_t off = pos & (ring_size - 1);
+    size_t first = min(len, ring_size - off);
+    size_t copied;
+
+    if (unlikely(READ_ONCE(bytewise_read)))
+        return ring_copy_to_iter_bytewise(q, pos, len, to);
+
+    copied = copy_to_iter(q->ring_data + off, first, to);
+    if (copied < first || first == len)
+        return copied;
+
+    return copied + copy_to_iter(q->ring_data, len - first, to);
+}
+
+/* Same as above into a kernel buffer, can not fail */
+static void ring_copy_to_kernel(struct mychardev_queue *q, char *dst, u64 pos, size_t len)
+{
+    size_t off = pos & (ring_size - 1);
+    size_t first = min(len, ring_size - off);
+
+    memcpy(dst, q->ring_data + off, first);
+    memcpy(dst + first, q->ring_data, len - first);
+}
+
+/* Same as above in the other direction, used when merging write buffers */
+static void ring_copy_from_kernel(struct mychardev_queue *q, u64 pos, const char *src, size_t len)
+{
+    size_t off = pos & (ring_size - 1);
+    size_t first = min(len, ring_size - off);
+
+    memcpy(q->ring_data + off, src, first);
+    memcpy(q->ring_data, src + first, len - first);
+}
+
+/* Wake the consumer, but only if it told us it ran out of data. A consumer
+ * that keeps up never sets need_wakeup, so the producer never pays for a
+ * wakeup (or even a wait queue lock) on its behalf.
+ */
+static void ring_wake_consumer(struct mychardev_queue *q)
+{
+    /* Order the head update against the need_wakeup check; pairs with the
+     * barrier the consumer issues between setting need_wakeup and re-reading head.
+     */
+    smp_mb();
+    if (READ_ONCE(q->ring_ctrl->need_wakeup) && xchg(&q->ring_ctrl->need_wakeup, 0)) {
+        this_cpu_inc(q->stats->wakeups);
+        wake_up_interruptible(&q->ring_wait);
+    }
+}
+
+/* How far the consumers got: with a mapping the consumer position is the
+ * tail it publishes, otherwise it is the readers' private ring_tail. The
+ * acquire pairs with the release of either: the consumer is done reading
+ * everything before it, so that space may be reused.
+ */
+static u64 ring_consumed(struct mychardev_queue *q)
+{
+    if (atomic_read(&q->ring_mapped))
+        return smp_load_acquire(&q->ring_ctrl->tail);
+    return smp_load_acquire(&q->ring_tail);
+}
+
+/* Where the next claim starts: the tail the mapping publishes while mapped,
+ * otherwise the end of the last claim a reader took.
+ */
+static u64 ring_next_claim(struct mychardev_queue *q)
+{
+    if (atomic_read(&q->ring_mapped))
+        return READ_ONCE(q->ring_ctrl->tail);
+    return atomic64_read(&q->ring_reserve) & ~RING_RESERVE_CLOSED;
+}
+
+/* Wait condition for readers: true when there is something left to claim.
+ * Otherwise arm need_wakeup first, so that the next write wakes us, and
+ * check again in case the write raced with arming.
+ */
+static bool ring_readable_or_arm(struct mychardev_queue *q)
+{
+    if (READ_ONCE(q->ring_head) != ring_next_claim(q))
+        return true;
+
+    WRITE_ONCE(q->ring_ctrl->need_wakeup, 1);
+    /* Pairs with the barrier in ring_wake_consumer, and with the one in
+     * device_write_iter: from here on any writer flushes its own buffer.
+     */
+    smp_mb();
+    return READ_ONCE(q->ring_head) != ring_next_claim(q);
+}
+
+/* Free space in the ring, as far as the producer side can tell */
+static size_t ring_space(struct mychardev_queue *q)
+{
+    u64 used = READ_ONCE(q->ring_head) - ring_consumed(q);
+
+    return used > ring_size ? 0 : ring_size - used;
+}
+
+/* Watch the mapping's progress for the writers waiting for space, see
+ * space_work. Called by a waiter after it queued itself on ring_space_wait.
+ */
+static void ring_space_watch(struct mychardev_queue *q)
+{
+    if (atomic_read(&q->ring_mapped) && !delayed_work_pending(&q->space_work))
+        schedule_delayed_work(&q->space_work, 1);
+}
+
+/* Runs once a tick while the ring is mapped and writers wait for space.
+ * They re-check how much they need themselves, so any space wakes them.
+ */
+static void ring_space_work(struct work_struct *work)
+{
+    struct mychardev_queue *q = container_of(to_delayed_work(work), struct mychardev_queue, space_work);
+
+    if (!wq_has_sleeper(&q->ring_space_wait))
+        return;
+    if (ring_space(q))
+        wake_up_interruptible(&q->ring_space_wait);
+    ring_space_watch(q);
+}
+
+/* Wait condition for writers: true when len bytes fit into the ring */
+static bool ring_space_or_watch(struct mychardev_queue *q, size_t len)
+{
+    if (ring_space(q) >= len)
+        return true;
+
+    ring_space_watch(q);
+    return false;
+}
+
+/* Move the whole content of a per-CPU buffer into the ring, in one piece so
+ * that the writes it holds stay contiguous. Called with buf->lock held.
+ * Returns -ENOSPC if the ring has no room for all of it yet.
+ */
+static int pcpu_flush(struct mychardev_queue *q, struct mychardev_pcpu_buf *buf)
+{
+    u64 tail;
+
+    if (!buf->len)
+        return SUCCESS;
+
+    mutex_lock(&q->ring_lock);
+
+    tail = ring_consumed(q);
+    if (q->ring_head - tail > ring_size) {
+        mutex_unlock(&q->ring_lock);
+        return -EIO;
+    }
+    if (ring_size - (q->ring_head - tail) < buf->len) {
+        mutex_unlock(&q->ring_lock);
+        return -ENOSPC;
+    }
+
+    ring_copy_from_kernel(q, q->ring_head, buf->data, buf->len);
+    /* Publish the data before the new head, to the readers and the mapping */
+    smp_store_release(&q->ring_head, q->ring_head + buf->len);
+    smp_store_release(&q->ring_ctrl->head, q->ring_head);
+
+    mutex_unlock(&q->ring_lock);
+
+    buf->len = 0;
+    this_cpu_inc(q->stats->merges);
+    ring_wake_consumer(q);
+    return SUCCESS;
+}
+
+/* Merge-on-read: called by a consumer that found the ring empty, after it
+ * armed need_wakeup. Takes every CPU's buffer lock in turn, so this is the
+ * one place where the write side sees cross-CPU locking, and it only happens
+ * when a consumer has nothing else to do.
+ */
+static void pcpu_merge_all(struct mychardev_queue *q)
+{
+    struct mychardev_pcpu_buf *buf;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        buf = per_cpu_ptr(q->pcpu_bufs, cpu);
+        if (!READ_ONCE(buf->len))
+            continue;
+        mutex_lock(&buf->lock);
+        pcpu_flush(q, buf);
+        mutex_unlock(&buf->lock);
+    }
+}
+
+/* Flush buf, sleeping until the ring has room for it. buf->lock is dropped
+ * while sleeping so that readers can still merge it (and other writers on
+ * this CPU can keep going); the caller re-checks buf->len afterwards.
+ */
+static int pcpu_flush_wait(struct mychardev_queue *q, struct mychardev_pcpu_buf *buf, bool nowait)
+{
+    long ret;
+
+    for (;;) {
+        ret = pcpu_flush(q, buf);
+        if (ret != -ENOSPC)
+            return ret;
+        if (nowait)
+            return -EAGAIN;
+
+        mutex_unlock(&buf->lock);
+        ret = wait_event_interruptible(q->ring_space_wait,
+                                       ring_space_or_watch(q, READ_ONCE(buf->len)));
+        mutex_lock(&buf->lock);
+        if (ret)
+            return ret;
+    }
+}
+
+/* Called by a consumer that is about to give up (sleep or -EAGAIN): arm
+ * need_wakeup, then pick up what writers left sitting in their per-CPU
+ * buffers. Returns true if there is something to read after all. This may
+ * sleep on the buffer mutexes, so it can not be used as a wait_event condition.
+ */
+static bool ring_prepare_wait(struct mychardev_queue *q)
+{
+    if (ring_readable_or_arm(q))
+        return true;
+
+    pcpu_merge_all(q);
+    return READ_ONCE(q->ring_head) != ring_next_claim(q);
+}
+
+/* Wait condition and poll test for writers */
+static bool device_writable(struct mychardev_queue *q)
+{
+    return READ_ONCE(raw_cpu_ptr(q->pcpu_bufs)->len) < pcpu_size || ring_space(q);
+}
+
+/* Called by readers after they handed space back to the producer */
+static void ring_wake_producers(struct mychardev_queue *q)
+{
+    /* wq_has_sleeper has the barrier that pairs with the one in the
+     * writer's wait_event, so the common case costs no wait queue lock.
+     */
+    if (wq_has_sleeper(&q->ring_space_wait))
+        wake_up_interruptible(&q->ring_space_wait);
+}
+
+/* Claim up to len bytes of the ring and copy them to the iterator.
+ * A claim is taken with a cmpxchg on ring_reserve, between the end of the
+ * last claim and the private ring_head, so nothing a consumer writes to the
+ * control page can make a reader wait on it or read outside the ring; no lock
+ * is shared between readers.
+ * The copy runs with page faults disabled, so a claim never waits on
+ * mmap_lock and device_mmap (which holds it) can wait for the claims in
+ * flight. The user buffer is faulted in beforehand; if a page went away
+ * again anyway, the rest of the claim is parked in mf->pending and returned
+ * by the next read. Kernel side iterators (splice, bvec) never fault.
+ * Returns the number of bytes copied (0 when the ring is empty), -EBUSY while
+ * the ring is mapped.
+ */
+static ssize_t ring_consume(struct mychardev_file *mf, struct iov_iter *to)
+{
+    struct mychardev_queue *q = mf->q;
+    size_t len = min_t(size_t, iov_iter_count(to), RING_CLAIM_MAX);
+    size_t n, copied;
+    s64 tail;
+    u64 head;
+
+    if (fault_in_iov_iter_writeable(to, len) == len)
+        return -EFAULT;
+
+    tail = atomic64_read(&q->ring_reserve);
+    do {
+        if (tail & RING_RESERVE_CLOSED)
+            return -EBUSY;
+        /* Never pair a head older than the reserve we saw. The acquire pairs
+         * with the smp_store_release of ring_head in pcpu_flush: the data
+         * bytes up to head are visible once we see the new head.
+         */
+        smp_rmb();
+        head = smp_load_acquire(&q->ring_head);
+        n = min_t(u64, len, head - tail);
+        if (!n)
+            return 0;
+    } while (!atomic64_try_cmpxchg(&q->ring_reserve, &tail, tail + n));
+
+    pagefault_disable();
+    copied = ring_copy_to_iter(q, tail, n, to);
+    pagefault_enable();
+
+    if (copied < n) {
+        ring_copy_to_kernel(q, mf->pending, tail + copied, n - copied);
+        mf->pending_len = n - copied;
+        mf->pending_pos = 0;
+    }
+
+    /* Hand the claim back once every earlier one is. The release orders our
+     * reads of the data before the producer reusing it; the control page
+     * gets a copy for show.
+     */
+    if (READ_ONCE(q->ring_tail) != tail)
+        wait_event(q->commit_wait, READ_ONCE(q->ring_tail) == tail);
+    smp_store_release(&q->ring_tail, tail + n);
+    WRITE_ONCE(q->ring_ctrl->tail, tail + n);
+    if (wq_has_sleeper(&q->commit_wait))
+        wake_up_all(&q->commit_wait);
+
+    return copied;
+}
+
 /* Called when a process, which already opened the dev file, attempts to
- * read from it.
-*/
-static ssize_t device_read(struct file *filp, /* see include/linux/fs.h */
-                           char __user *buffer, /* buffer to fill with data */
-                           size_t length, /* length of the buffer */
-                           loff_t *offset)
+ * read from it, with read(), readv(), io_uring or through splice.
+ * A reader first gets its pending bytes (the greeting msg), then drains the
+ * ring. The device is opened with stream_open, so there is no file offset:
+ * the ring is consumed, every byte goes to exactly one reader. When the ring
+ * is empty the reader sleeps on ring_wait until a writer pushes data, or gets
+ * -EAGAIN if it opened the device O_NONBLOCK (or asked for IOCB_NOWAIT).
+ */
+static ssize_t device_do_read(struct kiocb *iocb, struct iov_iter *to)
 {
-    /* Number of bytes actually written to the buffer */
-    int bytes_read = 0;
-    const char *msg_ptr = msg;
+    struct file *filp = iocb->ki_filp;
+    struct mychardev_file *mf = filp->private_data;
+    struct mychardev_queue *q = mf->q;
+    bool nowait = (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    ssize_t bytes_read = 0;
+    ssize_t copied;
+    size_t chunk;
+
+    if (mf->pending_pos < mf->pending_len && iov_iter_count(to)) {
+        chunk = min(iov_iter_count(to), mf->pending_len - mf->pending_pos);
+        copied = copy_to_iter(mf->pending + mf->pending_pos, chunk, to);
+        if (!copied)
+            return -EFAULT;
+        bytes_read += copied;
+        mf->pending_pos += copied;
+        if (copied < chunk || !iov_iter_count(to))
+            return bytes_read;
+    }
+
+    for (;;) {
+        while (iov_iter_count(to)) {
+            copied = ring_consume(mf, to);
+            if (copied < 0)
+                break;
+            bytes_read += copied;
+            /* The user buffer faulted, the rest of the claim waits in pending */
+            if (mf->pending_pos < mf->pending_len) {
+                copied = -EFAULT;
+                break;
+            }
+            if (!copied)
+                break;
+        }
+
+        if (bytes_read) {
+            this_cpu_inc(q->stats->reads);
+            this_cpu_add(q->stats->bytes_read, bytes_read);
+            ring_wake_producers(q);
+            /* Most read functions return the number of bytes put into the buffer. */
+            return bytes_read;
+        }
+        if (copied < 0)
+            return copied;
+
+        /* Nothing at all to read: wait for a writer, unless told not to */
+        if (ring_prepare_wait(q))
+            continue;
+        if (nowait)
+            return -EAGAIN;
+        if (wait_event_interruptible(q->ring_wait,
+                                     ring_readable_or_arm(q) || atomic_read(&q->ring_mapped)))
+            return -ERESTARTSYS;
+    }
+}
+
+/* The read_iter hook itself, a thin wrapper that traces each call */
+static ssize_t device_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct mychardev_queue *q = ((struct mychardev_file *)iocb->ki_filp->private_data)->q;
+    size_t count = iov_iter_count(to);
+    ssize_t ret;
+
+    ret = device_do_read(iocb, to);
+
+    trace_mychardev_read(q->index, count, ret);
+    if (static_branch_unlikely(&mychardev_debug))
+        pr_info("%s%u: read %zu bytes returned %zd\n", DEVICE_NAME, q->index, count, ret);
+
+    return ret;
+}
+
+/* Called when a process writes to dev file: echo "hi" > /dev/mychardev0
+ * (write(), writev(), io_uring or splice from a pipe).
+ * The data goes into the write buffer of the CPU we run on, see struct
+ * mychardev_pcpu_buf. When that buffer is full it is merged into the ring; if
+ * the ring is full too the writer sleeps until readers free some space, or
+ * gets -EAGAIN with O_NONBLOCK.
+ */
+static ssize_t device_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct file *filp = iocb->ki_filp;
+    struct mychardev_queue *q = ((struct mychardev_file *)filp->private_data)->q;
+    bool nowait = (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    struct mychardev_pcpu_buf *buf;
+    ssize_t written = 0;
+    size_t count = iov_iter_count(from);
+    size_t piece, copied;
+    int ret = 0;
+
+    if (!iov_iter_count(from))
+        return 0;
+
+    /* Preemption may move us to another CPU right after this; we then keep
+     * using the buffer we picked, which its mutex makes safe.
+     */
+    buf = raw_cpu_ptr(q->pcpu_bufs);
+    mutex_lock(&buf->lock);
+
+    while (iov_iter_count(from)) {
+        /* Make room first, so a write that fits into one buffer is never
+         * split across two merges.
+         */
+        piece = min(iov_iter_count(from), pcpu_size);
+        if (buf->len + piece > pcpu_size) {
+            ret = pcpu_flush_wait(q, buf, nowait);
+            if (ret)
+                break;
+            continue;
+        }
+
+        copied = copy_from_iter(buf->data + buf->len, piece, from);
+        buf->len += copied;
+        written += copied;
+        if (copied < piece) {
+            ret = -EFAULT;
+            break;
+        }
+    }
+
+    /* Pairs with the barrier in ring_readable_or_arm: either the consumer
+     * sees our bytes when it merges, or we see need_wakeup here.
+     */
+    smp_mb();
+    if (buf->len >= pcpu_size / 2 || READ_ONCE(q->ring_ctrl->need_wakeup))
+        pcpu_flush(q, buf);
+
+    mutex_unlock(&buf->lock);
 
-    if (!*(msg_ptr + *offset)) { /* we are at the end of message */
-        *offset = 0; /* reset the offset */
-        return 0; /* signify end of file */
+    if (written) {
+        this_cpu_inc(q->stats->writes);
+        this_cpu_add(q->stats->bytes_written, written);
     }
 
-    msg_ptr += *offset;
+    trace_mychardev_write(q->index, count, written ? written : ret);
+    if (static_branch_unlikely(&mychardev_debug))
+        pr_info("%s%u: write %zu bytes returned %zd\n", DEVICE_NAME, q->index, count,
+                written ? written : (ssize_t)ret);
+
+    return written ? written : ret;
+}
+
+/* While the ring is mapped, the mapping is the (single) consumer and moves
+ * ctrl->tail by itself. Count the mappings so read() can stay out of its way,
+ * and when the last one goes away pick up the consumer position it left and
+ * put back whatever it did to the head.
+ */
+static void device_vma_open(struct vm_area_struct *vma)
+{
+    struct mychardev_queue *q = vma->vm_private_data;
+
+    atomic_inc(&q->ring_mapped);
+}
 
-    /* Actually put the data into the buffer */
-    while (length && *msg_ptr) {
-        /* The buffer is in the user data segment, not the kernel
-         * segment so "*" assignment won't work. We have to use
-         * put_user which copies data from the kernel data segment to
-         * the user data segment.
+static void device_vma_close(struct vm_area_struct *vma)
+{
+    struct mychardev_queue *q = vma->vm_private_data;
+    u64 head, tail;
+
+    mutex_lock(&q->map_lock);
+    if (atomic_dec_and_test(&q->ring_mapped)) {
+        mutex_lock(&q->ring_lock);
+        head = q->ring_head;
+        tail = READ_ONCE(q->ring_ctrl->tail);
+        /* Never let a bogus tail make readers claim beyond the head, or
+         * before where the mapping started
          */
-        put_user(*(msg_ptr++), buffer++);
-        length--;
+        if (tail - q->ring_tail > head - q->ring_tail)
+            tail = head;
+        smp_store_release(&q->ring_tail, tail);
+        WRITE_ONCE(q->ring_ctrl->tail, tail);
+        WRITE_ONCE(q->ring_ctrl->head, head);
+        /* Open the ring to claims again, from where the mapping stopped */
+        atomic64_set_release(&q->ring_reserve, tail);
+        mutex_unlock(&q->ring_lock);
+        /* From here on read() wakes the writers, starting with this space */
+        ring_wake_producers(q);
+    }
+    mutex_unlock(&q->map_lock);
+}
+
+static const struct vm_operations_struct device_vm_ops = {
+    .open = device_vma_open,
+    .close = device_vma_close,
+};
+
+/* Called when a process mmaps the dev file. The whole ring (control page and
+ * data pages) is mapped in one go; the mapping has to start at offset 0 and
+ * can not be larger than the ring. Only one mapping of a queue may exist at
+ * a time (its forks and splits aside), a second mmap gets -EBUSY.
+ */
+static int device_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct mychardev_queue *q = ((struct mychardev_file *)filp->private_data)->q;
+    s64 reserve;
+    int ret;
 
-        bytes_read++;
+    if (vma->vm_pgoff)
+        return -EINVAL;
+
+    ret = mutex_lock_killable(&q->map_lock);
+    if (ret)
+        return ret;
+
+    if (atomic_read(&q->ring_mapped)) {
+        ret = -EBUSY;
+        goto out;
     }
 
-    *offset += bytes_read;
+    /* remap_vmalloc_range checks that the vma fits into the vmalloc area */
+    ret = remap_vmalloc_range(vma, q->ring_mem, 0);
+    if (ret)
+        goto out;
+
+    vma->vm_ops = &device_vm_ops;
+    vma->vm_private_data = q;
 
-    /* Most read functions return the number of bytes put into the buffer. */
-    return bytes_read;
+    /* Close the ring to new claims and wait for the ones in flight to be
+     * handed back, so the mapping starts at a settled tail. They are copies
+     * that never sleep or fault, so this does not wait long.
+     */
+    reserve = atomic64_fetch_or(RING_RESERVE_CLOSED, &q->ring_reserve);
+    wait_event(q->commit_wait, smp_load_acquire(&q->ring_tail) == (u64)reserve);
+    WRITE_ONCE(q->ring_ctrl->tail, q->ring_tail);
+    device_vma_open(vma);
+    /* Readers blocked in read() have to give way to the mapping, and writers
+     * already waiting for space now wait for the mapping's progress
+     */
+    wake_up_interruptible(&q->ring_wait);
+    if (wq_has_sleeper(&q->ring_space_wait))
+        ring_space_watch(q);
+
+out:
+    mutex_unlock(&q->map_lock);
+    return ret;
 }
 
-/* Called when a process writes to dev file: echo "hi" > /dev/hello */
-static ssize_t device_write(struct file *filp, const char __user *buff,
-                            size_t len, loff_t *off)
+/* Called by poll/select/epoll, so the device can sit in an epoll set next to
+ * sockets. Readers get EPOLLIN when there is data (an empty ring arms
+ * need_wakeup, so that the next write wakes them), writers get EPOLLOUT
+ * when the ring has space.
+ */
+static __poll_t device_poll(struct file *filp, struct poll_table_struct *wait)
 {
-    pr_alert("Sorry, this operation is not supported.\n");
-    return -EINVAL;
+    struct mychardev_file *mf = filp->private_data;
+    struct mychardev_queue *q = mf->q;
+    __poll_t mask = 0;
+
+    if (filp->f_mode & FMODE_READ) {
+        poll_wait(filp, &q->ring_wait, wait);
+        if (mf->pending_pos < mf->pending_len || ring_prepare_wait(q))
+            mask |= EPOLLIN | EPOLLRDNORM;
+    }
+
+    if (filp->f_mode & FMODE_WRITE) {
+        poll_wait(filp, &q->ring_space_wait, wait);
+        if (device_writable(q))
+            mask |= EPOLLOUT | EPOLLWRNORM;
+        else
+            ring_space_watch(q);
+    }
+
+    return mask;
+}
+
+/* Point an iov_iter at one user buffer of a batch descriptor */
+static int batch_import(int rw, u64 addr, u32 len, struct iovec *iov, struct iov_iter *iter)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+    return import_ubuf(rw, u64_to_user_ptr(addr), len, iter);
+#else
+    return import_single_range(rw, u64_to_user_ptr(addr), len, iov, iter);
+#endif
+}
+
+/* Run one batch descriptor through the same read_iter/write_iter code a
+ * plain read() or write() would use. Returns the bytes moved or -errno.
+ */
+static long batch_run_one(struct file *filp, const struct mychardev_msg_desc *desc, u32 flags)
+{
+    struct iov_iter iter;
+    struct iovec iov;
+    struct kiocb kiocb;
+    int ret;
+
+    /* result is an __s32, so one entry can not move more than INT_MAX bytes */
+    if (desc->reserved || desc->len > INT_MAX)
+        return -EINVAL;
+
+    init_sync_kiocb(&kiocb, filp);
+    if (flags & MYCHARDEV_BATCH_NOWAIT)
+        kiocb.ki_flags |= IOCB_NOWAIT;
+
+    switch (desc->op) {
+    case MYCHARDEV_OP_WRITE:
+        if (!(filp->f_mode & FMODE_WRITE))
+            return -EBADF;
+        ret = batch_import(WRITE, desc->addr, desc->len, &iov, &iter);
+        if (ret)
+            return ret;
+        return device_write_iter(&kiocb, &iter);
+    case MYCHARDEV_OP_READ:
+        if (!(filp->f_mode & FMODE_READ))
+            return -EBADF;
+        ret = batch_import(READ, desc->addr, desc->len, &iov, &iter);
+        if (ret)
+            return ret;
+        return device_read_iter(&kiocb, &iter);
+    default:
+        return -EINVAL;
+    }
+}
+
+/* MYCHARDEV_IOC_BATCH: process a whole array of small messages in one
+ * syscall. Descriptors are copied in and results copied back BATCH_CHUNK at a
+ * time, so the syscall entry and the user copies are amortized over the batch.
+ * Returns the number of descriptors processed (also stored in batch.done).
+ */
+static long device_ioctl_batch(struct file *filp, struct mychardev_batch __user *ubatch)
+{
+    struct mychardev_msg_desc descs[BATCH_CHUNK];
+    struct mychardev_msg_desc __user *udescs;
+    struct mychardev_batch batch;
+    u32 done = 0, n, i;
+    bool stop = false, interrupted = false;
+    long ret = 0;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+    if (batch.version != MYCHARDEV_ABI_VERSION)
+        return -EINVAL;
+    if (batch.count > MYCHARDEV_BATCH_MAX)
+        return -E2BIG;
+    if (batch.flags & ~(MYCHARDEV_BATCH_NOWAIT | MYCHARDEV_BATCH_STOP_ON_ERROR))
+        return -EINVAL;
+
+    udescs = u64_to_user_ptr(batch.descs);
+
+    while (done < batch.count && !stop) {
+        n = min_t(u32, batch.count - done, BATCH_CHUNK);
+        if (copy_from_user(descs, udescs + done, n * sizeof(descs[0]))) {
+            ret = -EFAULT;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            ret = batch_run_one(filp, &descs[i], batch.flags);
+            if (ret == -ERESTARTSYS) {
+                /* A signal came before the entry moved any byte. Leave it
+                 * uncounted, so the caller resubmits it from batch.done, or
+                 * the whole ioctl is restarted when nothing was done yet.
+                 */
+                interrupted = true;
+                stop = true;
+                break;
+            }
+            descs[i].result = ret;
+            if (ret < 0 && (batch.flags & MYCHARDEV_BATCH_STOP_ON_ERROR)) {
+                /* Count the failed entry too, its result tells why we stopped */
+                i++;
+                stop = true;
+                break;
+            }
+        }
+
+        if (copy_to_user(udescs + done, descs, i * sizeof(descs[0]))) {
+            ret = -EFAULT;
+            break;
+        }
+        done += i;
+        ret = 0;
+    }
+
+    if (put_user(done, &ubatch->done))
+        return -EFAULT;
+
+    /* Nothing processed at all: report why */
+    if (!done && interrupted)
+        return -ERESTARTSYS;
+    if (!done && ret < 0)
+        return ret;
+    return done;
+}
+
+/* Called on ioctl(fd, cmd, arg) */
+static long device_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case MYCHARDEV_IOC_VERSION:
+        return put_user((u32)MYCHARDEV_ABI_VERSION, (u32 __user *)arg);
+    case MYCHARDEV_IOC_BATCH:
+        return device_ioctl_batch(filp, (struct mychardev_batch __user *)arg);
+    default:
+        return -ENOTTY;
+    }
 }
 
 module_init(mychardev_init);
 module_exit(mychardev_exit);
 
 MODULE_LICENSE("GPL");
+
+/*
+Usage (run as root):
+    sudo insmod chardevicedriverexample.ko buffer_pages=4096    (16 MB ring)
+    sudo insmod chardevicedriverexample.ko nr_queues=0          (/dev/mychardev0..N, one queue per CPU)
+
+Every /dev/mychardevN is its own queue; shard producers and consumers across
+them (e.g. queue N for the workers pinned to CPU N) and nothing is shared
+between shards but the module code. Per queue counters:
+    cat /sys/class/mychardev/mychardev0/stats
+
+    echo "hello ring" > /dev/mychardev0
+    cat /dev/mychardev0             (blocks waiting for more data, ^C to stop)
+    dd if=/dev/mychardev0 iflag=nonblock of=/dev/null    (stops with EAGAIN when empty)
+
+Throughput, copying consumer:
+    dd if=/dev/zero of=/dev/mychardev0 bs=64K count=256 &
+    dd if=/dev/mychardev0 of=/dev/null bs=64K
+
+Bulk copy against the old per-byte loop, at different read sizes (1 GiB
+through the ring each time, MB/s of the reading dd):
+    P=/sys/module/chardevicedriverexample/parameters/bytewise_read
+    for b in N Y; do
+        echo $b > $P
+        for bs in 64 512 4K 64K 1M; do
+            dd if=/dev/zero of=/dev/mychardev0 bs=64K count=16384 2>/dev/null &
+            dd if=/dev/mychardev0 of=/dev/null bs=$bs count=1G iflag=count_bytes 2>&1 | tail -1
+            wait
+        done
+    done
+    echo N > $P
+With tiny reads both paths are bound by the syscall cost. From a few KB per
+read upward the bulk path is limited by memcpy bandwidth (or the writer),
+while the per-byte loop stays flat because every byte pays for its own user
+access.
+
+read() against readv() against splice() on the copying consumer, using fio
+(sync = read, vsync = readv, splice = splice into a pipe and vmsplice out):
+    for engine in sync vsync splice; do
+        fio --name=fill --filename=/dev/mychardev0 --rw=write --bs=64k \
+            --ioengine=psync --time_based --runtime=10 \
+            --name=drain --filename=/dev/mychardev0 --rw=read --bs=64k \
+            --ioengine=$engine --time_based --runtime=10 | grep -A1 'drain'
+    done
+Or straight from the device into a socket, with no user copy at all:
+    socat -u OPEN:/dev/mychardev0 TCP:host:port      (uses splice when it can)
+
+Writer scaling: one writer pinned to each of the first N cores, with a
+mmap or read consumer draining the ring (MB/s per N):
+    for n in 1 2 4 8 16; do
+        for c in $(seq 0 $((n - 1))); do
+            taskset -c $c dd if=/dev/zero of=/dev/mychardev0 bs=4K count=262144 2>&1 | tail -1 &
+        done
+        wait
+    done
+Each writer only takes its own CPU's buffer mutex; the ring lock is taken
+once per buffer merge (pcpu_buffer_pages pages), not once per write.
+
+Small messages in bulk: MYCHARDEV_IOC_BATCH (see mychardev_uapi.h) runs
+hundreds of reads/writes for one syscall:
+
+    struct mychardev_msg_desc d[256];    // op, addr, len filled in per message
+    struct mychardev_batch b = { .version = MYCHARDEV_ABI_VERSION,
+                                 .count = 256, .descs = (uintptr_t)d };
+    ioctl(fd, MYCHARDEV_IOC_BATCH, &b);  // d[i].result per message, b.done processed
+
+Any number of processes/threads can have the device open at once. Reader
+scaling with the thread count, using fio (reads/s per thread count, with one
+writer job keeping the ring full):
+    for t in 1 2 4 8 16 32; do
+        fio --name=fill --filename=/dev/mychardev0 --rw=write --bs=64k \
+            --ioengine=psync --time_based --runtime=10 \
+            --name=readers --filename=/dev/mychardev0 --rw=read --bs=4k \
+            --ioengine=psync --numjobs=$t --thread --time_based --runtime=10 \
+            --group_reporting | grep -A1 'readers'
+    done
+Readers share no lock: each claims its piece with a cmpxchg on ring_reserve
+and copies it out on its own, so ops/sec keeps growing with the thread count
+until that cache line, the in-order hand back of the claims or the producer
+is the limit. Give every thread its own open of the device (fio does), the
+bytes parked after a fault belong to the open file.
+
+Cost of the per call logging, small writes/s with debug off, with the
+tracepoints on, and with debug=1 (pr_info on every call):
+    P=/sys/module/chardevicedriverexample/parameters/debug
+    T=/sys/kernel/tracing/events/mychardev/enable
+    cat /dev/mychardev0 > /dev/null &
+    echo 0 > $P; echo 0 > $T; dd if=/dev/zero of=/dev/mychardev0 bs=64 count=1000000
+    echo 1 > $T;              dd if=/dev/zero of=/dev/mychardev0 bs=64 count=1000000
+    echo 0 > $T; echo 1 > $P; dd if=/dev/zero of=/dev/mychardev0 bs=64 count=1000000
+The first two should be within noise of each other; the last one is bound
+by the console.
+
+A zero-copy consumer mmaps the device (control page + data pages) and follows
+the protocol described in mychardev_uapi.h:
+
+    struct mychardev_ring_ctrl *ctrl = mmap(NULL, PAGE_SIZE + data_size,
+                                            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    char *data = (char *)ctrl + ctrl->data_offset;
+
+It only enters the kernel (poll) when the ring is empty, everything else is
+plain loads and stores on shared memory.
+*/
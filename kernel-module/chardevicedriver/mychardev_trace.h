@@ -0,0 +1,59 @@
+/*
+* mychardev_trace.h Tracepoints of the /dev/mychardevN read and write paths.
+* They cost a single patched-out jump while nobody traces them, so they can
+* stay on the hot paths where a pr_info per call would flood the log:
+*     echo 1 > /sys/kernel/tracing/events/mychardev/enable
+*     cat /sys/kernel/tracing/trace_pipe
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mychardev
+
+#if !defined(_MYCHARDEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MYCHARDEV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(mychardev_io,
+
+    TP_PROTO(unsigned int queue, size_t count, ssize_t ret),
+
+    TP_ARGS(queue, count, ret),
+
+    TP_STRUCT__entry(
+        __field(unsigned int, queue)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->queue = queue;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("queue=%u count=%zu ret=%zd", __entry->queue, __entry->count, __entry->ret)
+);
+
+/* One event per read_iter call, ret is the bytes read or a negative errno */
+DEFINE_EVENT(mychardev_io, mychardev_read,
+    TP_PROTO(unsigned int queue, size_t count, ssize_t ret),
+    TP_ARGS(queue, count, ret)
+);
+
+/* One event per write_iter call, ret is the bytes written or a negative errno */
+DEFINE_EVENT(mychardev_io, mychardev_write,
+    TP_PROTO(unsigned int queue, size_t count, ssize_t ret),
+    TP_ARGS(queue, count, ret)
+);
+
+#endif /* _MYCHARDEV_TRACE_H */
+
+/* The header is not in include/trace/events, tell define_trace.h where it is
+ * (the Makefile adds this directory to the include path).
+ */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mychardev_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,91 @@
+/*
+* mychardev_uapi.h Userspace ABI of /dev/mychardevN: the layout of the shared ring
+* exposed through mmap, and the batched ioctl interface.
+* This header is shared between the driver and userspace, so it only uses the
+* fixed size __u32/__u64 types from <linux/types.h>, and every struct has the
+* same layout for 32 and 64 bit callers (no pointers or longs, explicit padding).
+*
+* Every queue (minor) has its own ring. mmap(fd, offset 0) maps the control
+* page (struct mychardev_ring_ctrl) followed by data_size bytes of data pages.
+* head and tail are free running byte positions, the byte at position p lives
+* at data[p & (data_size - 1)]. A queue can only be mapped once at a time (a
+* second mmap gets EBUSY), and read() returns EBUSY while it is. Whatever the
+* mapping leaves in head and tail is checked against the driver's own copies
+* when it goes away.
+*
+* Consumer protocol (no syscalls while there is data):
+*   1. h = load_acquire(&ctrl->head)
+*   2. consume the bytes in [ctrl->tail, h) straight out of the data pages
+*   3. store_release(&ctrl->tail, h)
+*   4. when tail == head: store need_wakeup = 1, full barrier, re-check head,
+*      and only if it is still empty block in poll(fd, POLLIN).
+* The driver only issues a wakeup when need_wakeup is set, so a consumer that
+* keeps up with the producer never causes a single wakeup.
+*/
+
+#ifndef MYCHARDEV_UAPI_H
+#define MYCHARDEV_UAPI_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define MYCHARDEV_RING_VERSION 1
+
+struct mychardev_ring_ctrl {
+    __u32 version;      /* MYCHARDEV_RING_VERSION */
+    __u32 data_offset;  /* offset of the data pages from the start of the mapping */
+    __u32 data_size;    /* size of the data area, a power of two of at most 2 GiB */
+    __u32 need_wakeup;  /* set by an idle consumer, cleared by the producer when it wakes it */
+
+    /* Producer and consumer positions live on their own cache lines, so the
+     * producer writing head does not bounce the line the consumer writes tail on.
+     */
+    __u64 head __attribute__((aligned(64)));  /* written by the driver only */
+    __u64 tail __attribute__((aligned(64)));  /* written by the consumer */
+};
+
+/*
+* Batched submission: MYCHARDEV_IOC_BATCH takes an array of message
+* descriptors and runs each of them as if it was its own read() or write(),
+* but for the price of a single syscall. Every descriptor gets its own result.
+* A signal stops the batch before the entry it interrupted, which is left out
+* of mychardev_batch.done, so the caller can resubmit the rest from there.
+*
+* MYCHARDEV_ABI_VERSION is bumped whenever one of the structs below changes;
+* callers put the version they were built against into mychardev_batch.version
+* and can ask the driver for its version with MYCHARDEV_IOC_VERSION.
+*/
+#define MYCHARDEV_ABI_VERSION 1
+
+#define MYCHARDEV_BATCH_MAX 1024 /* max descriptors per MYCHARDEV_IOC_BATCH */
+
+enum mychardev_msg_op {
+    MYCHARDEV_OP_WRITE = 1, /* push len bytes from addr into the device */
+    MYCHARDEV_OP_READ = 2,  /* pull up to len bytes from the device into addr */
+};
+
+struct mychardev_msg_desc {
+    __u64 addr;     /* user buffer */
+    __u32 len;      /* length of the user buffer */
+    __u32 op;       /* enum mychardev_msg_op */
+    __s32 result;   /* out: bytes transferred, or a negative errno */
+    __u32 reserved; /* must be 0 */
+};
+
+/* Flags for mychardev_batch.flags */
+#define MYCHARDEV_BATCH_NOWAIT        (1U << 0) /* never sleep, entries that would block get -EAGAIN */
+#define MYCHARDEV_BATCH_STOP_ON_ERROR (1U << 1) /* stop at the first entry with a negative result */
+
+struct mychardev_batch {
+    __u32 version;  /* MYCHARDEV_ABI_VERSION */
+    __u32 count;    /* number of descriptors, at most MYCHARDEV_BATCH_MAX */
+    __u64 descs;    /* user pointer to struct mychardev_msg_desc[count] */
+    __u32 flags;    /* MYCHARDEV_BATCH_* */
+    __u32 done;     /* out: number of descriptors processed */
+};
+
+#define MYCHARDEV_IOC_MAGIC 'M'
+#define MYCHARDEV_IOC_VERSION _IOR(MYCHARDEV_IOC_MAGIC, 0, __u32)
+#define MYCHARDEV_IOC_BATCH _IOWR(MYCHARDEV_IOC_MAGIC, 1, struct mychardev_batch)
+
+#endif /* MYCHARDEV_UAPI_H */
@@ -0,0 +1,42 @@
+/*
+* procfs_trace.h Tracepoint for reads of /proc/procfs_myread, in place of a
+* pr_info per read:
+*     echo 1 > /sys/kernel/tracing/events/procfs_myread/enable
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM procfs_myread
+
+#if !defined(_PROCFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PROCFS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(procfs_myread_read,
+
+    TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+
+    TP_ARGS(count, pos, ret),
+
+    TP_STRUCT__entry(
+        __field(size_t, count)
+        __field(loff_t, pos)
+        __field(ssize_t, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->count = count;
+        __entry->pos = pos;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("count=%zu pos=%lld ret=%zd", __entry->count, __entry->pos, __entry->ret)
+);
+
+#endif /* _PROCFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE procfs_trace
+#include <trace/define_trace.h>
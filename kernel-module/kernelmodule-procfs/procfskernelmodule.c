@@ -1,24 +1,36 @@
 /*
- *Here a simple example showing how to use a /proc file. This is the process file read handler for the /proc filesystem. 
- *There are three parts: create the file /proc/procfs_myread in the function init_module, return a value 
- *(and a buffer) when the file /proc/procfs_myread is read in the callback function procfile_read, and delete
- *the file /proc/procfs_myread in the function cleanup_module.
+ *Here a simple example showing how to use a /proc file. This is the process file read handler for the /proc filesystem.
+ *There are three parts: create the file /proc/procfs_myread in the function init_module, return a value
+ *(and a buffer) when the file /proc/procfs_myread is read, and delete the file /proc/procfs_myread in the
+ *function cleanup_module.
 
- *The /proc/procfs_myread is created when the module is loaded with the function proc_create. The return value 
+ *The /proc/procfs_myread is created when the module is loaded with the function proc_create. The return value
  *is a struct proc_dir_entry, and it will be used to configure the file /proc/procfs_myread (for example, the owner of this
- *file). A null return value means that the creation has failed.Every time the file /proc/procfs_myread is read,
- *the function procfile_read is called. Two parameters of this function are very important: the buffer (the
- *second parameter) and the offset (the fourth one). The content of the buffer will be returned to the application 
- *which read it (for example the cat command).The offset is the current position in the file. If the return value
- *of the function is not null, then this function is called again. So be careful with this function,
- *if it never returns zero, the read function is called endlessly.
+ *file). A null return value means that the creation has failed.
+
+ *The file reports a table of nr_records records that the module builds when it is loaded. Writing a
+ *read handler by hand means keeping track of the offset and of how much of the output fits into the
+ *user's buffer, which gets hard as soon as the output is bigger than one buffer. The seq_file API does
+ *that for us (Ref: Linux Kernel Module Programming Guide Sec 7.3 Manage /proc file with seq_file):
+ *we only say how to walk the table (start/next/stop) and how to print one record (show). seq_read
+ *fills a single page sized buffer, copies it to the user and calls start again with the position
+ *of the next record for the next read, so a read at any offset resumes at the right record and the
+ *whole output is never built in memory at once.
  */
 
+#include <linux/jump_label.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
-#inlcude <linux/version.h>
+#include <linux/version.h>
+
+#define CREATE_TRACE_POINTS
+#include "procfs_trace.h"
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
 #define HAVE_PROC_OPS
@@ -26,46 +38,173 @@
 
 #define procfs_name "procfs_myread"
 
+/* Number of records in the table, e.g. insmod procfskernelmodule.ko nr_records=1000000 */
+static unsigned int nr_records = 1000;
+module_param(nr_records, uint, 0444);
+MODULE_PARM_DESC(nr_records, "Number of records reported by /proc/procfs_myread (default 1000)");
+
+struct myrecord {
+    u32 id;
+    u32 checksum;
+    u64 value;
+};
+
+static struct myrecord *records;
+
+/* debug=1 logs every read with pr_info. The check is a static key, so with
+ * debug off (the default) a read pays nothing for it; the procfs_myread_read
+ * tracepoint is the way to watch reads without the printk cost.
+ */
+static DEFINE_STATIC_KEY_FALSE(procfs_debug);
+
+static int debug_param_set(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(val, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        static_branch_enable(&procfs_debug);
+    else
+        static_branch_disable(&procfs_debug);
+    return 0;
+}
+
+static int debug_param_get(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n", static_key_enabled(&procfs_debug) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops debug_param_ops = {
+    .set = debug_param_set,
+    .get = debug_param_get,
+};
+module_param_cb(debug, &debug_param_ops, NULL, 0644);
+MODULE_PARM_DESC(debug, "Log every read of /proc/procfs_myread (default N)");
+
 static struct proc_dir_entry *our_proc_file;
 
-static ssize_t procfile_read(struct file *file_pointer, char __user *buffer, size_t buffer_length, loff_t *offset)
+/* Called at the start of every read, with *pos being the index of the first
+ * record to print. Position 0 is the header line, record i is at position i + 1.
+ */
+static void *procfs_seq_start(struct seq_file *s, loff_t *pos)
+{
+    if (*pos == 0)
+        return SEQ_START_TOKEN;
+    if (*pos > nr_records)
+        return NULL; // end of the table, the read returns 0 (EOF)
+    return &records[*pos - 1];
+}
+
+/* Called after every show, moves to the next record */
+static void *procfs_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+    ++*pos;
+    return procfs_seq_start(s, pos);
+}
+
+/* Called at the end of every read. The table never changes after module
+ * load, so start took no lock and there is nothing to release here.
+ */
+static void procfs_seq_stop(struct seq_file *s, void *v)
+{
+}
+
+/* Prints one record into the seq_file buffer */
+static int procfs_seq_show(struct seq_file *s, void *v)
 {
-    char s[31] = "MyModule-ProcFile-ReadHandler\n";
-    int len = sizeof(s);
-    ssize_t ret = len;
-
-    if (*offset >= len || copy_to_user(buffer, s, len)) {
-        pr_info("copy_to_user failed\n");
-        ret = 0;
-    } else {
-        pr_info("procfile read %s\n", file_pointer->f_path.dentry->d_name.name);
-        *offset += len;
+    const struct myrecord *rec = v;
+
+    if (v == SEQ_START_TOKEN) {
+        seq_puts(s, "id\tchecksum\tvalue\n");
+        return 0;
     }
 
+    seq_printf(s, "%u\t%08x\t%llu\n", rec->id, rec->checksum, rec->value);
+    return 0;
+}
+
+static const struct seq_operations procfs_seq_ops = {
+    .start = procfs_seq_start,
+    .next = procfs_seq_next,
+    .stop = procfs_seq_stop,
+    .show = procfs_seq_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file)
+{
+    return seq_open(file, &procfs_seq_ops);
+}
+
+/* seq_read does the work, this only reports what it did */
+static ssize_t procfile_read(struct file *file_pointer, char __user *buffer, size_t buffer_length, loff_t *offset)
+{
+    loff_t pos = *offset;
+    ssize_t ret;
+
+    ret = seq_read(file_pointer, buffer, buffer_length, offset);
+
+    trace_procfs_myread_read(buffer_length, pos, ret);
+    if (static_branch_unlikely(&procfs_debug))
+        pr_info("procfile read %s at %lld returned %zd\n",
+                file_pointer->f_path.dentry->d_name.name, pos, ret);
+
     return ret;
 }
 
-#ifdef HAVA_PROC_OPS
+#ifdef HAVE_PROC_OPS
 static const struct proc_ops proc_file_fops = {
+    .proc_open = procfile_open,
     .proc_read = procfile_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = seq_release,
 };
 #else
 static const struct file_operations proc_file_fops = {
+    .open = procfile_open,
     .read = procfile_read,
+    .llseek = seq_lseek,
+    .release = seq_release,
 };
 #endif
 
+// fills the table with some made up data
+static int records_alloc(void)
+{
+    unsigned int i;
+
+    records = kvmalloc_array(nr_records, sizeof(*records), GFP_KERNEL);
+    if (!records)
+        return -ENOMEM;
+
+    for (i = 0; i < nr_records; i++) {
+        records[i].id = i;
+        records[i].value = (u64)i * i;
+        records[i].checksum = i * 2654435761U; // multiplicative hash of the id
+    }
+
+    return 0;
+}
+
 // initialization of the module starts
 static int __init procfs_init(void)
 {
-    our_proc_file = proc_create(procfs_name, 0644, NULL, &proc_file_fops);
+    if (records_alloc()) {
+        pr_alert("Error: Could not allocate %u records\n", nr_records);
+        return -ENOMEM;
+    }
+
+    our_proc_file = proc_create(procfs_name, 0444, NULL, &proc_file_fops);
     if (NULL == our_proc_file) {
-        proc_remove(our_proc_file);
+        kvfree(records);
         pr_alert("Error: Could not initialize /proc/%s\n", procfs_name);
         return -ENOMEM;
     }
 
-    pr_info("/proc/%s created\n",procfs_name);
+    pr_info("/proc/%s created with %u records\n", procfs_name, nr_records);
     return 0;
 }
 
@@ -73,10 +212,33 @@ static int __init procfs_init(void)
 static void __exit procfs_exit(void)
 {
     proc_remove(our_proc_file);
+    kvfree(records);
     pr_info("/proc/%s removed\n",procfs_name);
 }
 
 module_init(procfs_init);
 module_exit(procfs_exit);
 
-MODULE_LICENSE("GPL");
\ No newline at end of file
+MODULE_LICENSE("GPL");
+
+/*
+Benchmark (run as root), dumping a million record table:
+    sudo insmod procfskernelmodule.ko nr_records=1000000
+    /usr/bin/time -v cat /proc/procfs_myread > /dev/null
+        "Elapsed (wall clock) time" is the time to format and copy out the whole table,
+        "Maximum resident set size" is the peak memory of cat; it stays at the size of
+        cat's own buffer because the module hands the output over one page at a time.
+    grep -E 'Slab|VmallocUsed' /proc/meminfo    (before and during the dump)
+        the module side only adds the records table (16 bytes per record, allocated at
+        load time) and one seq_file page per open file.
+    dd if=/proc/procfs_myread bs=1 skip=5000000 count=64 status=none
+        a read at any offset resumes in the middle of the right record.
+    sudo rmmod procfskernelmodule
+
+Cost of logging each read (reads/s of a small read at offset 0):
+    P=/sys/module/procfskernelmodule/parameters/debug
+    T=/sys/kernel/tracing/events/procfs_myread/enable
+    echo 0 > $P; echo 0 > $T; time (for i in $(seq 100000); do head -c 64 /proc/procfs_myread; done > /dev/null)
+    echo 1 > $T;              time (...same...)
+    echo 0 > $T; echo 1 > $P; time (...same...)
+*/
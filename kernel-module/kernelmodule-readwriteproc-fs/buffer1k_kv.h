@@ -0,0 +1,17 @@
+/*
+* buffer1k_kv.h Lookups in the key/value store behind /proc/buffer1k, for other
+* kernel modules. Both calls are lock free (RCU) and never sleep, so they can
+* be used on hot paths; the store itself is updated through /proc/buffer1k.
+*/
+
+#ifndef BUFFER1K_KV_H
+#define BUFFER1K_KV_H
+
+#include <linux/types.h>
+
+#define BUFFER1K_KV_KEY_MAX 64 /* keys are at most BUFFER1K_KV_KEY_MAX - 1 bytes */
+
+const char *buffer1k_kv_lookup_rcu(const char *key, size_t *len);
+ssize_t buffer1k_kv_get(const char *key, char *buf, size_t size);
+
+#endif /* BUFFER1K_KV_H */
@@ -0,0 +1,51 @@
+/*
+* procfs_rw_trace.h Tracepoints for reads and writes of /proc/buffer1k_log:
+*     echo 1 > /sys/kernel/tracing/events/procfs_rw/enable
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM procfs_rw
+
+#if !defined(_PROCFS_RW_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PROCFS_RW_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(procfs_rw_io,
+
+    TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+
+    TP_ARGS(count, pos, ret),
+
+    TP_STRUCT__entry(
+        __field(size_t, count)
+        __field(loff_t, pos)
+        __field(ssize_t, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->count = count;
+        __entry->pos = pos;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("count=%zu pos=%lld ret=%zd", __entry->count, __entry->pos, __entry->ret)
+);
+
+DEFINE_EVENT(procfs_rw_io, procfs_rw_read,
+    TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+    TP_ARGS(count, pos, ret)
+);
+
+DEFINE_EVENT(procfs_rw_io, procfs_rw_write,
+    TP_PROTO(size_t count, loff_t pos, ssize_t ret),
+    TP_ARGS(count, pos, ret)
+);
+
+#endif /* _PROCFS_RW_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE procfs_rw_trace
+#include <trace/define_trace.h>
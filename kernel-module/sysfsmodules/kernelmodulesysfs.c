@@ -9,64 +9,544 @@ providing a means to read and write kernel attributes.
 
 Below module creates reads/updates attribute in a file in sysfs under its module directory.
 */
-<
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/kobject.h>
+#include <linux/local64.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/preempt.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/string.h>
 #include <linux/sysfs.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+
+#include "mysysfsmodule.h"
+#include "mysysfsmodule_stats.h"
+
+/* bin_attribute callbacks get a const attribute since v6.13, through the
+ * read_new member until v6.17 renamed it back to read.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+#define BIN_ATTR_CONST const
+#else
+#define BIN_ATTR_CONST
+#endif
 
 static struct kobject *mysysfsmodule;
 
-/* the variable you want to change*/
-static int syscustomvariable = 0;
+/* The variables you want to change, all tunables of the module in one
+ * struct mysysfs_config (see mysysfsmodule.h). The struct is never changed in
+ * place: a writer copies the current one, changes the copy, validates it as a
+ * whole and publishes it with rcu_assign_pointer. A reader does one
+ * rcu_dereference and gets a snapshot where all the fields belong together,
+ * without a lock and without ever waiting for a writer; the old copy is freed
+ * once no reader can still be looking at it. Writers are serialized by
+ * config_lock, a spinlock so that mysysfsmodule_set_syscustomvariable works
+ * from any context.
+ *
+ * Every published change bumps config->generation. Watchers poll() the files
+ * for POLLPRI instead of re-reading them on a timer; the generation tells them
+ * whether they missed changes in between.
+ */
+static struct mysysfs_config __rcu *config;
+static DEFINE_SPINLOCK(config_lock);
+
+/* The kernfs nodes of the files that are notified on changes, looked up once
+ * at init: sysfs_notify_dirent on them never sleeps, unlike sysfs_notify
+ * which looks the file up by name each time.
+ */
+enum {
+    KN_SYSCUSTOMVARIABLE,
+    KN_LOWER_BOUND,
+    KN_UPPER_BOUND,
+    KN_CONFIG,
+    KN_GENERATION,
+    NR_KN,
+};
+
+static const char * const notify_names[NR_KN] = {
+    [KN_SYSCUSTOMVARIABLE] = "syscustomvariable",
+    [KN_LOWER_BOUND] = "lower_bound",
+    [KN_UPPER_BOUND] = "upper_bound",
+    [KN_CONFIG] = "config",
+    [KN_GENERATION] = "generation",
+};
+
+static struct kernfs_node *notify_kn[NR_KN];
+
+static void config_notify(int i)
+{
+    /* NULL only while init has not looked the nodes up yet */
+    if (notify_kn[i])
+        sysfs_notify_dirent(notify_kn[i]);
+}
+
+/* The binary stats block (layout in mysysfsmodule_stats.h): a header
+ * followed by a slot of counters per possible CPU, all in one
+ * vmalloc_user area so that the whole block can be mmap'ed. Every CPU only
+ * adds to its own slot, with local64 operations: no lock, no atomic
+ * instruction, and no cache line shared with another CPU.
+ */
+struct mysysfs_cpu_slot {
+    local64_t counters[MYSYSFS_STATS_COUNTERS];
+};
+
+static void *stats_mem;
+static size_t stats_len;
+
+static struct mysysfs_cpu_slot *stats_slot(int cpu)
+{
+    return stats_mem + sizeof(struct mysysfs_stats_header) + cpu * sizeof(struct mysysfs_cpu_slot);
+}
+
+/**
+ * mysysfsmodule_stat_add - add delta to one counter of the stats block
+ * @counter: enum mysysfs_stat, counters from MYSYSFS_STAT_USER0 on are free for callers
+ * @delta: what to add
+ *
+ * Safe in any context, including interrupts; it only touches this CPU's slot.
+ */
+void mysysfsmodule_stat_add(unsigned int counter, u64 delta)
+{
+    if (WARN_ON_ONCE(counter >= MYSYSFS_STATS_COUNTERS))
+        return;
+
+    preempt_disable();
+    local64_add(delta, &stats_slot(smp_processor_id())->counters[counter]);
+    preempt_enable();
+}
+EXPORT_SYMBOL_GPL(mysysfsmodule_stat_add);
+
+static u64 stats_sum(unsigned int counter)
+{
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        sum += local64_read(&stats_slot(cpu)->counters[counter]);
+    return sum;
+}
+
+/**
+ * mysysfsmodule_config - the current configuration
+ *
+ * Must be called under rcu_read_lock; the snapshot stays valid until
+ * rcu_read_unlock and is never modified.
+ */
+const struct mysysfs_config *mysysfsmodule_config(void)
+{
+    return rcu_dereference(config);
+}
+EXPORT_SYMBOL_GPL(mysysfsmodule_config);
+
+/* A change to some of the tunables. Only the fields with their has_ flag set
+ * are changed, the rest is taken over from the current config.
+ */
+struct config_change {
+    bool has_value, has_lower, has_upper;
+    int value, lower, upper;
+};
+
+static bool config_valid(const struct mysysfs_config *c)
+{
+    return c->lower_bound <= c->syscustomvariable && c->syscustomvariable <= c->upper_bound;
+}
+
+/* Applies chg to a copy of the current config and publishes the copy if it is
+ * valid and differs from the current one. gfp is GFP_ATOMIC for callers that
+ * can not sleep.
+ */
+static int config_apply(const struct config_change *chg, gfp_t gfp)
+{
+    struct mysysfs_config *old, *new;
+    unsigned long flags;
+
+    new = kmalloc(sizeof(*new), gfp);
+    if (!new)
+        return -ENOMEM;
+
+    spin_lock_irqsave(&config_lock, flags);
+    old = rcu_dereference_protected(config, lockdep_is_held(&config_lock));
+    *new = *old;
+    if (chg->has_value)
+        new->syscustomvariable = chg->value;
+    if (chg->has_lower)
+        new->lower_bound = chg->lower;
+    if (chg->has_upper)
+        new->upper_bound = chg->upper;
+
+    if (!config_valid(new)) {
+        spin_unlock_irqrestore(&config_lock, flags);
+        kfree(new);
+        return -EINVAL;
+    }
+
+    if (new->syscustomvariable == old->syscustomvariable &&
+        new->lower_bound == old->lower_bound && new->upper_bound == old->upper_bound) {
+        /* Nothing changed, nobody to wake */
+        spin_unlock_irqrestore(&config_lock, flags);
+        kfree(new);
+        return 0;
+    }
+
+    new->generation = old->generation + 1;
+    rcu_assign_pointer(config, new);
+    spin_unlock_irqrestore(&config_lock, flags);
+
+    if (new->syscustomvariable != old->syscustomvariable)
+        config_notify(KN_SYSCUSTOMVARIABLE);
+    if (new->lower_bound != old->lower_bound)
+        config_notify(KN_LOWER_BOUND);
+    if (new->upper_bound != old->upper_bound)
+        config_notify(KN_UPPER_BOUND);
+    config_notify(KN_CONFIG);
+    config_notify(KN_GENERATION);
 
-static ssize_t syscustomvariable_show(struct kobject *kobj,
-                                      struct kobj_attribute *attr, char *buf)
+    kfree_rcu(old, rcu);
+    return 0;
+}
+
+/**
+ * mysysfsmodule_set_syscustomvariable - change syscustomvariable from the kernel
+ * @value: the new value
+ *
+ * Same as a write to /sys/kernel/mysysfsmodule/syscustomvariable: when the
+ * value actually changes a new config is published and poll()ers are woken.
+ * May be called from any context.
+ * Return: 0, -EINVAL if value is outside of the bounds, or -ENOMEM.
+ */
+int mysysfsmodule_set_syscustomvariable(int value)
 {
-    return sprintf(buf, "%d\n", syscustomvariable);
+    struct config_change chg = { .has_value = true, .value = value };
+
+    return config_apply(&chg, GFP_ATOMIC);
 }
+EXPORT_SYMBOL_GPL(mysysfsmodule_set_syscustomvariable);
 
-static ssize_t syscustomvariable_store(struct kobject *kobj,
-                                      struct kobj_attribute *attr, char *buf,
-                                      size_t count)
+/* Shared tail of the store handlers */
+static ssize_t config_store_change(const struct config_change *chg, size_t count)
 {
-    sscanf(buf, "%du", &syscustomvariable);
+    int ret;
+
+    ret = config_apply(chg, GFP_KERNEL);
+    if (ret) {
+        mysysfsmodule_stat_add(MYSYSFS_STAT_STORE_ERROR, 1);
+        return ret;
+    }
+
+    mysysfsmodule_stat_add(MYSYSFS_STAT_STORE, 1);
     return count;
 }
 
+/* One show and store pair per single tunable */
+#define CONFIG_INT_ATTR(_name, _field, _has)                                                \
+static ssize_t _name##_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)   \
+{                                                                                           \
+    int value;                                                                              \
+                                                                                            \
+    mysysfsmodule_stat_add(MYSYSFS_STAT_SHOW, 1);                                           \
+    rcu_read_lock();                                                                        \
+    value = rcu_dereference(config)->_name;                                                 \
+    rcu_read_unlock();                                                                      \
+    return sprintf(buf, "%d\n", value);                                                     \
+}                                                                                           \
+                                                                                            \
+static ssize_t _name##_store(struct kobject *kobj, struct kobj_attribute *attr,             \
+                             const char *buf, size_t count)                                 \
+{                                                                                           \
+    struct config_change chg = { ._has = true };                                            \
+                                                                                            \
+    if (kstrtoint(buf, 10, &chg._field)) {                                                  \
+        mysysfsmodule_stat_add(MYSYSFS_STAT_STORE_ERROR, 1);                                \
+        return -EINVAL;                                                                     \
+    }                                                                                       \
+    return config_store_change(&chg, count);                                                \
+}
+
+CONFIG_INT_ATTR(syscustomvariable, value, has_value)
+CONFIG_INT_ATTR(lower_bound, lower, has_lower)
+CONFIG_INT_ATTR(upper_bound, upper, has_upper)
+
+/* All the tunables in one file. Writing "name=value" pairs, separated by
+ * spaces, changes all of them in one step, e.g. moving the bounds and the
+ * value together where changing them one by one would go through an invalid
+ * state.
+ */
+static ssize_t config_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    const struct mysysfs_config *c;
+    ssize_t len;
+
+    mysysfsmodule_stat_add(MYSYSFS_STAT_SHOW, 1);
+    rcu_read_lock();
+    c = rcu_dereference(config);
+    len = sprintf(buf, "syscustomvariable=%d lower_bound=%d upper_bound=%d\n",
+                  c->syscustomvariable, c->lower_bound, c->upper_bound);
+    rcu_read_unlock();
+    return len;
+}
+
+static ssize_t config_store_attr(struct kobject *kobj, struct kobj_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    struct config_change chg = {};
+    char *copy, *cur, *tok, *val;
+    int ret = 0;
+
+    copy = kstrndup(buf, count, GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+
+    cur = strim(copy);
+    while (!ret && (tok = strsep(&cur, " \t\n"))) {
+        if (!*tok)
+            continue;
+        val = strchr(tok, '=');
+        if (!val) {
+            ret = -EINVAL;
+            break;
+        }
+        *val++ = '\0';
+
+        if (!strcmp(tok, "syscustomvariable")) {
+            chg.has_value = true;
+            ret = kstrtoint(val, 10, &chg.value);
+        } else if (!strcmp(tok, "lower_bound")) {
+            chg.has_lower = true;
+            ret = kstrtoint(val, 10, &chg.lower);
+        } else if (!strcmp(tok, "upper_bound")) {
+            chg.has_upper = true;
+            ret = kstrtoint(val, 10, &chg.upper);
+        } else {
+            ret = -EINVAL;
+        }
+    }
+    kfree(copy);
+
+    if (ret) {
+        mysysfsmodule_stat_add(MYSYSFS_STAT_STORE_ERROR, 1);
+        return -EINVAL;
+    }
+    return config_store_change(&chg, count);
+}
+
+static ssize_t generation_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    unsigned long gen;
+
+    rcu_read_lock();
+    gen = rcu_dereference(config)->generation;
+    rcu_read_unlock();
+    return sprintf(buf, "%lu\n", gen);
+}
+
+/* The stats for humans: one "counter total" line per counter, summed over the CPUs */
+static ssize_t stats_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    static const char * const names[MYSYSFS_STAT_USER0] = {
+        [MYSYSFS_STAT_SHOW] = "show",
+        [MYSYSFS_STAT_STORE] = "store",
+        [MYSYSFS_STAT_STORE_ERROR] = "store_error",
+    };
+    unsigned int i;
+    int len = 0;
+
+    for (i = 0; i < MYSYSFS_STATS_COUNTERS; i++) {
+        if (i < MYSYSFS_STAT_USER0)
+            len += sysfs_emit_at(buf, len, "%s %llu\n", names[i], stats_sum(i));
+        else
+            len += sysfs_emit_at(buf, len, "user%u %llu\n", i - MYSYSFS_STAT_USER0, stats_sum(i));
+    }
+    return len;
+}
+
 // setting the setter and getter in kobject attribute
 /*To read or write attributes, show() or store() method must be specified
 when declaring the attribute. For the common cases include/linux/sysfs.h provides 
 convenience macros (__ATTR, __ATTR_RO, __ATTR_WO, etc.) to make defining attributes 
 easier as well as making code more concise and readable.*/
 static struct kobj_attribute syscustomvariable_attribute =
-    __ATTR(syscustomvariable, 0660, syscustomvariable_show, (void *)syscustomvariable_store);
+    __ATTR(syscustomvariable, 0660, syscustomvariable_show, syscustomvariable_store);
+static struct kobj_attribute lower_bound_attribute =
+    __ATTR(lower_bound, 0660, lower_bound_show, lower_bound_store);
+static struct kobj_attribute upper_bound_attribute =
+    __ATTR(upper_bound, 0660, upper_bound_show, upper_bound_store);
+static struct kobj_attribute config_attribute =
+    __ATTR(config, 0660, config_show, config_store_attr);
+
+static struct kobj_attribute generation_attribute = __ATTR_RO(generation);
+static struct kobj_attribute stats_attribute = __ATTR_RO(stats);
+
+static struct attribute *mysysfsmodule_attrs[] = {
+    &syscustomvariable_attribute.attr,
+    &lower_bound_attribute.attr,
+    &upper_bound_attribute.attr,
+    &config_attribute.attr,
+    &generation_attribute.attr,
+    &stats_attribute.attr,
+    NULL,
+};
+
+/* Binary attributes skip the text formatting entirely: the whole stats block
+ * comes back in a single read(), at the offset asked for. sysfs already
+ * cuts reads at the size of the attribute.
+ */
+static ssize_t stats_bin_read(struct file *file, struct kobject *kobj, BIN_ATTR_CONST struct bin_attribute *attr,
+                              char *buf, loff_t off, size_t count)
+{
+    memcpy(buf, stats_mem + off, count);
+    return count;
+}
+
+/* ... or it can be mapped, and then reading counters costs no syscall at all */
+static int stats_bin_mmap(struct file *file, struct kobject *kobj, BIN_ATTR_CONST struct bin_attribute *attr,
+                          struct vm_area_struct *vma)
+{
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    /* Nor may an O_RDWR opener mprotect it writable later */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    return remap_vmalloc_range(vma, stats_mem, vma->vm_pgoff);
+}
+
+static struct bin_attribute stats_bin_attribute = {
+    .attr = { .name = "stats_bin", .mode = 0444 },
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 17, 0)
+    .read_new = stats_bin_read,
+#else
+    .read = stats_bin_read,
+#endif
+    .mmap = stats_bin_mmap,
+    /* .size is set in kernelmodulesysfs_init, it depends on the number of CPUs */
+};
+
+static struct bin_attribute *mysysfsmodule_bin_attrs[] = {
+    &stats_bin_attribute,
+    NULL,
+};
+
+static const struct attribute_group mysysfsmodule_group = {
+    .attrs = mysysfsmodule_attrs,
+    .bin_attrs = mysysfsmodule_bin_attrs,
+};
+
+static int stats_alloc(void)
+{
+    struct mysysfs_stats_header *hdr;
+
+    /* The layout userspace sees has to match the one we update */
+    BUILD_BUG_ON(sizeof(local64_t) != sizeof(__u64));
+    BUILD_BUG_ON(sizeof(struct mysysfs_cpu_slot) != sizeof(struct mysysfs_cpu_stats));
+    BUILD_BUG_ON(sizeof(struct mysysfs_stats_header) != 64);
+
+    stats_len = sizeof(*hdr) + nr_cpu_ids * sizeof(struct mysysfs_cpu_slot);
+    stats_mem = vmalloc_user(PAGE_ALIGN(stats_len)); /* zeroed */
+    if (!stats_mem)
+        return -ENOMEM;
+
+    hdr = stats_mem;
+    hdr->version = MYSYSFS_STATS_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->nr_cpus = nr_cpu_ids;
+    hdr->cpu_stride = sizeof(struct mysysfs_cpu_slot);
+    hdr->nr_counters = MYSYSFS_STATS_COUNTERS;
+
+    stats_bin_attribute.size = stats_len;
+    return 0;
+}
+
+static int config_alloc(void)
+{
+    struct mysysfs_config *c;
+
+    c = kzalloc(sizeof(*c), GFP_KERNEL);
+    if (!c)
+        return -ENOMEM;
+
+    c->syscustomvariable = 0;
+    c->lower_bound = INT_MIN;
+    c->upper_bound = INT_MAX;
+    RCU_INIT_POINTER(config, c);
+    return 0;
+}
+
+static void notify_kn_put(void)
+{
+    int i;
+
+    for (i = 0; i < NR_KN; i++) {
+        sysfs_put(notify_kn[i]);
+        notify_kn[i] = NULL;
+    }
+}
 
-// creating the sysfs file using module init and assigning the attribute to the file
+// creating the sysfs files using module init and assigning the attributes to the files
 static int __init kernelmodulesysfs_init(void)
 {
     int error = 0;
+    int i;
     pr_info("kernelmodulesysfs_init: initialized\n");
 
+    error = stats_alloc();
+    if (error)
+        return error;
+
+    error = config_alloc();
+    if (error)
+        goto fail_stats;
+
     mysysfsmodule = kobject_create_and_add("mysysfsmodule", kernel_kobj);
-    if (!mysysfsmodule)
-        return -ENOMEM;
+    if (!mysysfsmodule) {
+        error = -ENOMEM;
+        goto fail_config;
+    }
     
-    error = sysfs_create_file(mysysfsmodule, &syscustomvariable_attribute.attr);
+    error = sysfs_create_group(mysysfsmodule, &mysysfsmodule_group);
     if (error) {
-        pr_info("failed to create the myvariable file "
-                "in /sys/kernel/mymodule\n");
+        pr_info("failed to create the attribute files "
+                "in /sys/kernel/mysysfsmodule\n");
+        goto fail_kobj;
+    }
+
+    for (i = 0; i < NR_KN; i++) {
+        notify_kn[i] = sysfs_get_dirent(mysysfsmodule->sd, notify_names[i]);
+        if (!notify_kn[i]) {
+            error = -ENOENT;
+            goto fail_kn;
+        }
     }
 
+    return 0;
+
+fail_kn:
+    notify_kn_put();
+fail_kobj:
+    kobject_put(mysysfsmodule);
+fail_config:
+    kfree(rcu_dereference_protected(config, 1));
+fail_stats:
+    vfree(stats_mem);
     return error;
 }
 
 static void __exit kernelmodulesysfs_exit(void)
 {
     pr_info("kernelmodulesysfs: Exit success\n");
-    kobject_put(kernelmodulesysfs);
+    notify_kn_put();
+    kobject_put(mysysfsmodule);
+    /* Wait for the kfree_rcu of replaced configs, then free the current one */
+    rcu_barrier();
+    kfree(rcu_dereference_protected(config, 1));
+    /* Mappings still around keep their own reference on the pages */
+    vfree(stats_mem);
 }
 
 module_init(kernelmodulesysfs_init);
@@ -75,18 +555,34 @@ module_exit(kernelmodulesysfs_exit);
 MODULE_LICENSE("GPL");
 
 /*
-sudo insmod hello-sysfs.ko
+sudo insmod kernelmodulesysfs.ko
 
 Check that it exists:
-    sudo lsmod | grep hello_sysfs
+    sudo lsmod | grep kernelmodulesysfs
 
-What is the current value of myvariable ?
-    cat /sys/kernel/mymodule/myvariable
-Set the value of myvariable and check that it changed.
-    echo "32" > /sys/kernel/mymodule/myvariable
-    cat /sys/kernel/mymodule/myvariable
+What is the current value of syscustomvariable ?
+    cat /sys/kernel/mysysfsmodule/syscustomvariable
+Set the value of syscustomvariable and check that it changed.
+    echo "32" > /sys/kernel/mysysfsmodule/syscustomvariable
+    cat /sys/kernel/mysysfsmodule/syscustomvariable
+Change several tunables in one step (readers never see a mix of old and new):
+    cat /sys/kernel/mysysfsmodule/config
+    echo "lower_bound=10 syscustomvariable=15 upper_bound=20" > /sys/kernel/mysysfsmodule/config
+    echo "25" > /sys/kernel/mysysfsmodule/syscustomvariable    (EINVAL, out of bounds)
+
+Wait for changes instead of re-reading (sysfs files wake poll() with POLLPRI,
+the file has to be read once before the first poll and read again from
+offset 0 after every wakeup):
+    python3 -c '
+import select
+f = open("/sys/kernel/mysysfsmodule/generation")
+p = select.poll(); p.register(f, select.POLLPRI | select.POLLERR)
+while True:
+    f.seek(0); print("generation", f.read().strip())
+    p.poll()'
+    echo "33" > /sys/kernel/mysysfsmodule/syscustomvariable    (in another shell)
 Finally, remove the test module:
-    sudo rmmod hello_sysfs
+    sudo rmmod kernelmodulesysfs
 
 In the above case, we use a simple kobject to create a directory under
 sysfs, and communicate with its attributes. Since Linux v2.6.0, the kobject
@@ -98,4 +594,28 @@ mission creep, it is now the glue that holds much of the device model and
 its sysfs interface together. For more information about kobject and sysfs,
 see Documentation/driver-api/driver-model/driver.rst and https://lwn.net/
 Articles/51437/.
-*/
\ No newline at end of file
+
+Scrape cost, all counters of all CPUs 10000 times, text against binary, both
+from one process so only the formatting differs:
+    python3 -c '
+import os, struct, time
+n = 10000
+fd = os.open("/sys/kernel/mysysfsmodule/stats", os.O_RDONLY)
+t = time.perf_counter()
+for i in range(n):
+    totals = [int(l.split()[1]) for l in os.pread(fd, 1 << 16, 0).splitlines()]
+print("text   %.1f us per scrape" % ((time.perf_counter() - t) / n * 1e6))
+fd = os.open("/sys/kernel/mysysfsmodule/stats_bin", os.O_RDONLY)
+t = time.perf_counter()
+for i in range(n):
+    blk = os.pread(fd, 1 << 20, 0)
+    ver, hsize, ncpu, stride, nctr = struct.unpack_from("5I", blk)
+    totals = [sum(struct.unpack_from("Q", blk, hsize + c * stride + 8 * k)[0]
+                  for c in range(ncpu)) for k in range(nctr)]
+print("binary %.1f us per scrape" % ((time.perf_counter() - t) / n * 1e6))'
+Both are one pread() per scrape. The text file sums and formats every
+counter in the kernel and gets parsed back; the binary block is copied out
+as it is and summed here, which costs more Python the more CPUs there are,
+so time the bare pread() loops too to see the kernel side alone. An
+agent that mmaps stats_bin reads the counters without any syscall.
+*/
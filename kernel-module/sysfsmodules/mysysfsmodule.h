@@ -0,0 +1,30 @@
+/*
+* mysysfsmodule.h What other kernel modules can call in kernelmodulesysfs.c.
+*/
+
+#ifndef MYSYSFSMODULE_H
+#define MYSYSFSMODULE_H
+
+#include <linux/types.h>
+
+/* The tunables of the module, published as a whole (see mysysfsmodule_config) */
+struct mysysfs_config {
+    int syscustomvariable;    /* always within [lower_bound, upper_bound] */
+    int lower_bound;
+    int upper_bound;
+    unsigned long generation; /* bumped on every change */
+    struct rcu_head rcu;
+};
+
+/* The current config, under rcu_read_lock; never modified, never torn */
+const struct mysysfs_config *mysysfsmodule_config(void);
+
+/* Adds delta to counter (enum mysysfs_stat) of the stats block, any context */
+void mysysfsmodule_stat_add(unsigned int counter, u64 delta);
+
+/* Sets syscustomvariable and wakes its watchers if it changed, any context.
+ * Returns -EINVAL when value is outside of the bounds.
+ */
+int mysysfsmodule_set_syscustomvariable(int value);
+
+#endif /* MYSYSFSMODULE_H */
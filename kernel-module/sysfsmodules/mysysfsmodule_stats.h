@@ -0,0 +1,44 @@
+/*
+* mysysfsmodule_stats.h Layout of /sys/kernel/mysysfsmodule/stats_bin, the
+* binary stats block of kernelmodulesysfs.c. Shared between the module and
+* whatever reads the block (monitoring agents), so it only uses the fixed size
+* types from <linux/types.h> and has the same layout for 32 and 64 bit readers.
+*
+* The block is a header followed by one slot of counters per possible CPU:
+*     slot of cpu c = (char *)block + header_size + c * cpu_stride
+* A counter's total is the sum over all the slots. Every counter is a 64 bit
+* value that is only ever written with a single store, so a 64 bit reader
+* never sees a torn value. Read the whole block with one pread(), or mmap it
+* (read only) and read the counters as they change.
+*/
+
+#ifndef MYSYSFSMODULE_STATS_H
+#define MYSYSFSMODULE_STATS_H
+
+#include <linux/types.h>
+
+#define MYSYSFS_STATS_VERSION 1 /* bumped whenever the layout below changes */
+
+enum mysysfs_stat {
+    MYSYSFS_STAT_SHOW,        /* reads of syscustomvariable */
+    MYSYSFS_STAT_STORE,       /* accepted writes to syscustomvariable */
+    MYSYSFS_STAT_STORE_ERROR, /* rejected writes to syscustomvariable */
+    MYSYSFS_STAT_USER0,       /* first counter left to other modules, see mysysfsmodule_stat_add */
+    MYSYSFS_STATS_COUNTERS = 16,
+};
+
+struct mysysfs_stats_header {
+    __u32 version;      /* MYSYSFS_STATS_VERSION */
+    __u32 header_size;  /* offset of the slot of CPU 0 */
+    __u32 nr_cpus;      /* number of slots */
+    __u32 cpu_stride;   /* bytes from one slot to the next */
+    __u32 nr_counters;  /* counters per slot, MYSYSFS_STATS_COUNTERS */
+    __u32 reserved[11]; /* 0, pads the header to one cache line */
+};
+
+/* One slot fills two cache lines, CPUs never share a line */
+struct mysysfs_cpu_stats {
+    __u64 counters[MYSYSFS_STATS_COUNTERS];
+};
+
+#endif /* MYSYSFSMODULE_STATS_H */